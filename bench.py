@@ -0,0 +1,273 @@
+import os
+import re
+import sys
+import csv
+import json
+import math
+import time
+import argparse
+import subprocess
+from string import Template
+from typing import Dict, List, Optional
+
+
+w = 1.5
+e = 0.000000001
+sizes = [10**3, 10**4, 10**5, 10**6, 10**7]  # A sizes, dense A must fit in memory
+timeout_s = 3600
+
+# Matrix catalog, generated inside the solvers with -g/-k
+catalog = [
+    {"name": "tridiag_0.5", "g": "tridiag", "k": 0.5},
+    {"name": "tridiag_0.9", "g": "tridiag", "k": 0.9},
+    {"name": "tridiag_0.99", "g": "tridiag", "k": 0.99},
+    {"name": "laplace", "g": "laplace", "k": 0},
+    {"name": "random", "g": "random", "k": 0},
+]
+
+
+def module_path():
+    return os.path.dirname(os.path.realpath(__file__))
+
+
+algs_paths = {
+    "c_pthread": os.path.join(module_path(), "c_pthreads", "build", "sor"),
+    "c_omp": os.path.join(module_path(), "c_omp", "build", "sor"),
+    "c_mpi": os.path.join(module_path(), "c_mpi", "build", "sor"),
+}
+
+algs: Dict[str, Template] = {
+    "c_pthreads": Template(
+        f"{algs_paths['c_pthread']} -g $g -k $k -n $n -t $t -e $e -w $w"
+    ),
+    "c_omp": Template(f"{algs_paths['c_omp']} -g $g -k $k -n $n -t $t -e $e -w $w"),
+    "c_mpi": Template(
+        f"mpirun --use-hwthread-cpus -np $t {algs_paths['c_mpi']} -g $g -k $k -n $n -e $e -w $w"
+    ),
+}
+
+result_re = re.compile(r"Get result for (\d+) iterations")
+# Timed by the solvers around the sweeps alone, without start-up and generation
+sweep_time_re = re.compile(r"Sweep time (\S+) ms")
+
+
+def system_size(family: dict, n: int) -> int:
+    # The Laplacian lives on a square grid
+    if family["g"] == "laplace":
+        return int(math.isqrt(n)) ** 2
+    return n
+
+
+def fits_in_memory(n: int, instances: int, alg: str) -> bool:
+    # Dense int32 A, one copy per MPI rank
+    copies = instances if alg == "c_mpi" else 1
+    mem = os.sysconf("SC_PAGE_SIZE") * os.sysconf("SC_PHYS_PAGES")
+    return n * n * 4 * copies < mem // 2
+
+
+def run(alg: str, family: dict, n: int, instances: int) -> Optional[dict]:
+    cmd = algs[alg].substitute(
+        g=family["g"], k=family["k"], n=n, t=instances, e=e, w=w
+    )
+    print(cmd)
+
+    start_timestamp = time.time()
+    try:
+        result = subprocess.run(
+            cmd.split(), capture_output=True, text=True, timeout=timeout_s
+        )
+    except subprocess.TimeoutExpired:
+        print("timeout")
+        return None
+    elapsed_ms = (time.time() - start_timestamp) * 1000
+
+    match = result_re.search(result.stdout)
+    sweep_time = sweep_time_re.search(result.stdout)
+    if result.returncode != 0 or match is None or sweep_time is None:
+        print("not converged")
+        return None
+
+    return {
+        "sweeps": int(match.group(1)),
+        "elapsed_ms": elapsed_ms,
+        "ms_per_sweep": float(sweep_time.group(1)),
+    }
+
+
+def instance_counts(max_instances: int) -> List[int]:
+    counts = [1]
+    while counts[-1] * 2 <= max_instances:
+        counts.append(counts[-1] * 2)
+    if counts[-1] != max_instances:
+        counts.append(max_instances)
+    return counts
+
+
+def bench(args) -> List[dict]:
+    rows = list()
+    cache = dict()
+    families = [f for f in catalog if args.families is None or f["name"] in args.families]
+
+    for alg in args.algs:
+        for family in families:
+            for base_n in sizes:
+                if base_n > args.max_n:
+                    continue
+
+                # Strong scaling: fixed n. Weak scaling: dense work per
+                # instance kept constant, n grows with sqrt(instances).
+                for mode in ["strong", "weak"]:
+                    t1 = None
+                    for instances in instance_counts(args.max_instances):
+                        scale = 1 if mode == "strong" else math.sqrt(instances)
+                        n = system_size(family, int(base_n * scale))
+                        row = {
+                            "alg": alg,
+                            "family": family["name"],
+                            "mode": mode,
+                            "base_n": base_n,
+                            "n": n,
+                            "instances": instances,
+                            "status": "ok",
+                            "sweeps": None,
+                            "elapsed_ms": None,
+                            "ms_per_sweep": None,
+                            "efficiency": None,
+                        }
+
+                        # Still recorded, so that the baseline comparison
+                        # sees the missing runs
+                        if not fits_in_memory(n, instances, alg):
+                            rows.append({**row, "status": "skipped"})
+                            continue
+
+                        # Both modes share the single-instance run
+                        run_key = (alg, family["name"], n, instances)
+                        if run_key not in cache:
+                            cache[run_key] = run(alg, family, n, instances)
+                        res = cache[run_key]
+                        if res is None:
+                            rows.append({**row, "status": "failed"})
+                            continue
+
+                        if instances == 1:
+                            t1 = res["ms_per_sweep"]
+                        efficiency = None
+                        if t1 is not None:
+                            efficiency = t1 / res["ms_per_sweep"]
+                            if mode == "strong":
+                                efficiency /= instances
+
+                        rows.append({**row, **res, "efficiency": efficiency})
+                        print(rows[-1])
+
+    return rows
+
+
+def key(row: dict) -> str:
+    return "/".join(
+        str(row[k]) for k in ["alg", "family", "mode", "base_n", "instances"]
+    )
+
+
+def in_scope(base: dict, args) -> bool:
+    families = [f["name"] for f in catalog if args.families is None or f["name"] in args.families]
+    return (
+        base["alg"] in args.algs
+        and base["family"] in families
+        and base["base_n"] <= args.max_n
+        and base["instances"] in instance_counts(args.max_instances)
+    )
+
+
+def compare(rows: List[dict], baseline: Dict[str, dict], tolerance: float, args) -> bool:
+    ok = True
+    current = {key(row): row for row in rows}
+
+    # A run that is gone, crashed, timed out or did not converge is a
+    # regression, and so is one that failed already when the baseline was
+    # taken: it stays reported until the case converges again. Runs that do
+    # not fit in memory on this host are only noted.
+    for base_key, base in baseline.items():
+        if not in_scope(base, args):
+            continue
+        row = current.get(base_key)
+        status = "missing" if row is None else row["status"]
+        if status == "ok" or (status == "skipped" and base["status"] == "skipped"):
+            if status == "skipped":
+                print(f"SKIP {base_key}: does not fit in memory")
+            continue
+
+        ok = False
+        note = "" if base["status"] == "ok" else f", baseline {base['status']}"
+        print(f"FAIL {base_key}: {status}{note}")
+
+    for row in rows:
+        base = baseline.get(key(row))
+        if base is None:
+            if row["status"] == "failed":
+                ok = False
+                print(f"FAIL {key(row)}: failed, not in baseline")
+            continue
+        if row["status"] != "ok" or base["status"] != "ok":
+            continue
+
+        checks = [
+            ("ms_per_sweep", row["ms_per_sweep"] <= base["ms_per_sweep"] * (1 + tolerance)),
+            ("sweeps", row["sweeps"] <= math.ceil(base["sweeps"] * (1 + tolerance))),
+        ]
+        if row["efficiency"] is not None and base["efficiency"] is not None:
+            checks.append(
+                ("efficiency", row["efficiency"] >= base["efficiency"] * (1 - tolerance))
+            )
+
+        for name, passed in checks:
+            if not passed:
+                ok = False
+                print(f"FAIL {key(row)} {name}: {row[name]} vs baseline {base[name]}")
+
+    return ok
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Scaling regression benchmark.")
+    parser.add_argument("--algs", nargs="+", default=list(algs.keys()), choices=list(algs.keys()))
+    parser.add_argument("--families", nargs="+", default=None, help="Catalog entries to run")
+    parser.add_argument("--max-n", type=int, default=sizes[-1], help="Largest base size")
+    parser.add_argument("--max-instances", type=int, default=os.cpu_count(), help="Threads / procs")
+    parser.add_argument("--baseline", type=str, default=os.path.join(module_path(), "bench_baseline.json"))
+    parser.add_argument("--update-baseline", action="store_true", help="Store results as the new baseline")
+    parser.add_argument("--tolerance", type=float, default=0.1, help="Allowed relative regression")
+    args = parser.parse_args()
+
+    rows = bench(args)
+
+    bench_out = os.path.join(module_path(), "bench_out.csv")
+    with open(bench_out, "w") as f:
+        csv_writer = csv.DictWriter(f, fieldnames=list(rows[0].keys()) if rows else ["alg"])
+        csv_writer.writeheader()
+        csv_writer.writerows(rows)
+
+    if args.update_baseline:
+        with open(args.baseline, "w") as f:
+            # Failed and skipped runs too, so that they are not dropped from the checks
+            json.dump({key(row): row for row in rows}, f, indent=2)
+        print(f"Baseline stored in {args.baseline}")
+        return 0
+
+    if not os.path.exists(args.baseline):
+        print(f"No baseline {args.baseline}, run with --update-baseline first")
+        return 0
+
+    with open(args.baseline, "r") as f:
+        baseline = json.load(f)
+
+    if not compare(rows, baseline, args.tolerance, args):
+        return 1
+
+    print("PASS")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
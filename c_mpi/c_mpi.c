@@ -1,4 +1,5 @@
 #include <errno.h>
+#include <fcntl.h>
 #include <float.h>
 #include <malloc.h>
 #include <math.h>
@@ -10,26 +11,88 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
 #define PARAM_ABS_MAX 100
 #define ITERATIONS_MAX 1000
+#define STREAM_BLOCK_BYTES (64 << 20)
+
+// Element type of A and b, chosen at build time (make COEF=int|float|double)
+// so that every kernel is compiled for exactly one coefficient type. X and the
+// row sums are real_t, the same type as A in the float and double builds, so
+// their row products take no conversions. An int A has no real counterpart,
+// that build keeps X in double.
+#if defined(COEF_DOUBLE)
+typedef double coef_t;
+typedef double real_t;
+#define COEF_SCN "%lf"
+#define COEF_MPI MPI_DOUBLE
+#define REAL_MPI MPI_DOUBLE
+#elif defined(COEF_FLOAT)
+typedef float coef_t;
+typedef float real_t;
+#define COEF_SCN "%f"
+#define COEF_MPI MPI_FLOAT
+#define REAL_MPI MPI_FLOAT
+#else
+typedef int coef_t;
+typedef double real_t;
+#define COEF_SCN "%d"
+#define COEF_MPI MPI_INT
+#define REAL_MPI MPI_DOUBLE
+#endif
+
+#define GEN_SEED 1234567890ULL
+#define GEN_TRIDIAG_DIAG 1000000
+
+#define GEN_STREAM_A 0
+#define GEN_STREAM_B 1
+#define GEN_STREAM_DIAG 2
+
+enum gen_family_e {
+    GEN_RANDOM,
+    GEN_TRIDIAG,
+    GEN_LAPLACE,
+};
 
-#define MPI_SEND_E_TAG 1000
+// Stopping criteria: max |X_new - X_old|, or ||r|| / ||b|| in L2 or Linf.
+// The residual is exact for the iterate a sweep starts from, so it trails the
+// update by one sweep.
+enum criterion_e {
+    CRIT_UPDATE,
+    CRIT_L2,
+    CRIT_LINF,
+};
 
 
 struct global_ctx_s {
     int32_t i;
-    int *A;
+    coef_t *A;
     uint32_t n;
-    int *b;
-    double *e;
-    double *X;
+    coef_t *b;
+    real_t *X;
+    // X at the start of the sweep, for the lower part of the residual
+    real_t *X_prev;
     double max_e;
     double w;
 
     int run;
+
+    // Out-of-core mode: A points into a read-only mapping of the system
+    // file, which is swept in blocks of stream_rows rows.
+    size_t A_map_len;
+    uint32_t stream_rows;
+    bool stream;
+
+    enum gen_family_e gen_family;
+    double gen_coupling;
+
+    enum criterion_e criterion;
+    double b_norm;
 };
 
 void _debug(const char *format, ...) {
@@ -46,12 +109,45 @@ void _debug(const char *format, ...) {
     va_end(args);
 }
 
+void stream_madvise(struct global_ctx_s *gctx, uint32_t block, int advice) {
+    long page = sysconf(_SC_PAGESIZE);
+    uint64_t row_bytes = (uint64_t)gctx->n * sizeof(*gctx->A);
+    uintptr_t base = (uintptr_t)gctx->A;
+    uintptr_t start = base + (uint64_t)block * gctx->stream_rows * row_bytes;
+    uintptr_t end = start + gctx->stream_rows * row_bytes;
+
+    if (end > base + gctx->n * row_bytes) end = base + gctx->n * row_bytes;
+
+    // Widen the range for prefetch, shrink it for release so that the
+    // pages shared with the neighbouring blocks stay resident.
+    if (advice == MADV_WILLNEED) {
+        start &= ~(page - 1);
+    } else {
+        start = (start + page - 1) & ~(page - 1);
+        end &= ~(page - 1);
+    }
+
+    if (start < end) madvise((void *)start, end - start, advice);
+}
+
+void stream_advance(struct global_ctx_s *gctx, uint32_t block) {
+    uint32_t blocks = (gctx->n + gctx->stream_rows - 1) / gctx->stream_rows;
+
+    // Current block, the prefetched one and the released one must differ
+    if (blocks < 3) return;
+
+    stream_madvise(gctx, (block + 1) % blocks, MADV_WILLNEED);
+    stream_madvise(gctx, (block + blocks - 1) % blocks, MADV_DONTNEED);
+}
+
 double sor(struct global_ctx_s *gctx, double *solution_e) {
     int ret = 0;
-    int *b = gctx->b;
-    int *A = gctx->A;
-    double *X = gctx->X;
-    MPI_Request e_req;
+    coef_t *b = gctx->b;
+    coef_t *A = gctx->A;
+    real_t *X = gctx->X;
+    real_t w = gctx->w;
+    MPI_Request e_req = MPI_REQUEST_NULL;
+    MPI_Op e_op = gctx->criterion == CRIT_L2 ? MPI_SUM : MPI_MAX;
     int size, rank, own_rows_num;
 
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
@@ -62,90 +158,138 @@ double sor(struct global_ctx_s *gctx, double *solution_e) {
            own_rows_num);
 
     int row;
-    double old_X, fpart, spart;
+    coef_t *A_row;
+    uint32_t block = UINT32_MAX;
+    real_t old_X, fpart, spart, res_part, res;
+    double e, local_e, send_e, global_e;
     while (gctx->run) {
+        local_e = 0;
+
+        // Every rank holds the whole X once a sweep is over
+        memcpy(gctx->X_prev, X, sizeof(*X) * gctx->n);
+
         for (int row_i = 0; row_i < own_rows_num; row_i++) {
             row = rank + size * row_i;
 
+            // Every rank has its own mapping, so each advances on the first
+            // of its rows that falls into a new block
+            if (gctx->stream && row / gctx->stream_rows != block) {
+                block = row / gctx->stream_rows;
+                stream_advance(gctx, block);
+            }
+
+            // 64-bit offset, n * n overflows 32 bits in the sizes that
+            // need streaming
+            A_row = A + (uint64_t)row * gctx->n;
+
             old_X = X[row];
-            fpart = (1 - gctx->w) * old_X;
+            fpart = (1 - w) * old_X;
 
             spart = b[row];
             for (int i = row + 1; i < gctx->n; i++) {
-                spart -= A[row * gctx->n + i] * X[i];
+                spart -= A_row[i] * X[i];
             }
 
+            // The lower part is taken against both the new and the previous
+            // values, the latter gives the exact residual of the iterate
+            // this sweep started from
+            res_part = spart;
             for (int i = 0; i < row; i++) {
                 if (row - i < size) {
                     int row_owner_rank = i % size;
                     if (row_owner_rank != rank) {
-                        MPI_Bcast(&gctx->X[i], 1, MPI_DOUBLE, row_owner_rank,
+                        MPI_Bcast(&gctx->X[i], 1, REAL_MPI, row_owner_rank,
                                   MPI_COMM_WORLD);
                         // _debug("Get x%d %g from %d", i, gctx->X[i],
                         //        row_owner_rank);
                     }
                 }
 
-                spart -= A[row * gctx->n + i] * X[i];
+                spart -= A_row[i] * X[i];
+                res_part -= A_row[i] * gctx->X_prev[i];
             }
 
-            spart = gctx->w * (spart / (double)A[row * gctx->n + row]);
+            res = res_part - A_row[row] * old_X;
+
+            spart = w * (spart / (real_t)A_row[row]);
             X[row] = fpart + spart;
 
-            MPI_Bcast(&X[row], 1, MPI_DOUBLE, rank, MPI_COMM_WORLD);
+            MPI_Bcast(&X[row], 1, REAL_MPI, rank, MPI_COMM_WORLD);
 
-            gctx->e[row] = fabs(old_X - X[row]);
-            if (rank != 0) {
-                MPI_Isend(&gctx->e[row], 1, MPI_DOUBLE, 0, MPI_SEND_E_TAG,
-                          MPI_COMM_WORLD, &e_req);
-            }
+            e = gctx->criterion == CRIT_UPDATE ? fabs(old_X - X[row])
+                                               : fabs(res);
+            if (gctx->criterion == CRIT_L2)
+                local_e += e * e;
+            else if (local_e < e)
+                local_e = e;
 
             if (row_i + 1 == own_rows_num) {
                 for (int i = row + 1; i < gctx->n; i++) {
-                    MPI_Bcast(&gctx->X[i], 1, MPI_DOUBLE, i % size,
+                    MPI_Bcast(&gctx->X[i], 1, REAL_MPI, i % size,
                               MPI_COMM_WORLD);
                     // _debug("Get last x%d %g from %d", i, gctx->X[i], i % size);
                 }
             }
         }
 
-        if (rank == 0) {
-            double cur_e_max = 0;
-            for (int i = 0; i < gctx->n; i++) {
-                int row_owner = i % size;
-                if (row_owner != rank) {
-                    MPI_Irecv(&gctx->e[i], 1, MPI_DOUBLE, row_owner,
-                              MPI_SEND_E_TAG, MPI_COMM_WORLD, &e_req);
-                    MPI_Wait(&e_req, MPI_STATUS_IGNORE);
-                }
+        // The vote of the previous sweep was reduced while this one ran, so
+        // the stop is detected with at most one extra sweep
+        if (e_req != MPI_REQUEST_NULL) {
+            MPI_Wait(&e_req, MPI_STATUS_IGNORE);
 
-                if (cur_e_max < gctx->e[i]) cur_e_max = gctx->e[i];
-            }
+            if (gctx->criterion == CRIT_L2) global_e = sqrt(global_e);
+            global_e /= gctx->b_norm;
 
-            if (gctx->i >= ITERATIONS_MAX) {
-                ret = -1;
-                gctx->run = 0;
-            } else if (cur_e_max <= gctx->max_e) {
+            if (global_e <= gctx->max_e) {
                 gctx->run = 0;
-                *solution_e = cur_e_max;
-            } else {
-                gctx->i++;
-                // printf("X: \n");
-                // for (int i = 0; i < gctx->n; i++) {
-                //     printf("%.2f ", gctx->X[i]);
-                // }
-                // printf("\n");
+                *solution_e = global_e;
+                break;
             }
         }
 
-        MPI_Bcast(&gctx->run, 1, MPI_INT, 0, MPI_COMM_WORLD);
-        // if (rank == 0) _debug("Iteration: %d", gctx->i);
+        if (gctx->i >= ITERATIONS_MAX) {
+            ret = -1;
+            gctx->run = 0;
+            break;
+        }
+
+        send_e = local_e;
+        MPI_Iallreduce(&send_e, &global_e, 1, MPI_DOUBLE, e_op,
+                       MPI_COMM_WORLD, &e_req);
+        gctx->i++;
     }
 
     printf("Worker %d is finished\n", rank);
     return ret;
 }
 
+// True residual r = b - AX: every rank takes its own rows, rank 0 gets totals
+void residual(struct global_ctx_s *gctx, double *r_l2, double *r_inf) {
+    int size, rank;
+    double local[2] = {0, 0}, total[2] = {0, 0};
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    for (uint32_t row = rank; row < gctx->n; row += size) {
+        double r = gctx->b[row];
+        for (uint32_t i = 0; i < gctx->n; i++) {
+            r -= gctx->A[(uint64_t)row * gctx->n + i] * gctx->X[i];
+        }
+
+        local[0] += r * r;
+        if (local[1] < fabs(r)) local[1] = fabs(r);
+    }
+
+    MPI_Reduce(&local[0], &total[0], 1, MPI_DOUBLE, MPI_SUM, 0,
+               MPI_COMM_WORLD);
+    MPI_Reduce(&local[1], &total[1], 1, MPI_DOUBLE, MPI_MAX, 0,
+               MPI_COMM_WORLD);
+
+    *r_l2 = sqrt(total[0]);
+    *r_inf = total[1];
+}
+
 int count_digits(int n) {
     if (n == 0) return 1;
 
@@ -161,58 +305,209 @@ int populate_ab_from_file(struct global_ctx_s *gctx, char *path) {
 
     for (int i = 0; i < gctx->n; i++) {
         for (int j = 0; j < gctx->n; j++) {
-            fscanf(f, "%d", &gctx->A[i * gctx->n + j]);
+            if (fscanf(f, COEF_SCN, &gctx->A[(uint64_t)i * gctx->n + j]) != 1) {
+                fprintf(stderr, "Bad coefficient at row %d, column %d\n", i, j);
+                fclose(f);
+                return -1;
+            }
+        }
+        if (fscanf(f, COEF_SCN, &gctx->b[i]) != 1) {
+            fprintf(stderr, "Bad right-hand side at row %d\n", i);
+            fclose(f);
+            return -1;
         }
-        fscanf(f, "%d", &gctx->b[i]);
     }
     fclose(f);
 
     return 0;
 }
 
-int populate_ab(struct global_ctx_s *gctx) {
-    uint32_t new_max;
+int populate_ab_from_binary_file(struct global_ctx_s *gctx, char *path) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Filed to open file");
+        return -1;
+    }
 
-    // srand(time(NULL));
-    srand(1234567890);
-    for (int i = 0; i < gctx->n; i++) {
-        gctx->b[i] = rand() % (2 * PARAM_ABS_MAX + 1) - PARAM_ABS_MAX;
-        gctx->A[i * gctx->n + i] = 0;
-        while (gctx->A[i * gctx->n + i] == 0)
-            gctx->A[i * gctx->n + i] =
-                rand() % (2 * PARAM_ABS_MAX + 1) - PARAM_ABS_MAX;
-        new_max =
-            (uint32_t)(abs(gctx->A[i * gctx->n + i]) / (double)(gctx->n - 1) -
-                       1);
+    gctx->A_map_len =
+        sizeof(*gctx->A) * ((uint64_t)gctx->n * gctx->n + gctx->n);
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size != gctx->A_map_len) {
+        fprintf(stderr, "Binary system must hold %lu values of %lu bytes\n",
+                (uint64_t)gctx->n * gctx->n + gctx->n, sizeof(coef_t));
+        close(fd);
+        return -1;
+    }
 
-        for (int j = 0; j < gctx->n; j++) {
-            if (i != j) {
-                gctx->A[i * gctx->n + j] = rand() % (2 * new_max + 1) - new_max;
+    gctx->A = mmap(NULL, gctx->A_map_len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (gctx->A == MAP_FAILED) {
+        gctx->A = NULL;
+        perror("Filed to map file");
+        return -1;
+    }
+
+    memcpy(gctx->b, gctx->A + (uint64_t)gctx->n * gctx->n,
+           sizeof(*gctx->b) * gctx->n);
+    madvise(gctx->A, gctx->A_map_len, MADV_DONTNEED);
+
+    if (gctx->stream_rows == 0)
+        gctx->stream_rows = STREAM_BLOCK_BYTES / (gctx->n * sizeof(*gctx->A));
+    if (gctx->stream_rows == 0) gctx->stream_rows = 1;
+    stream_madvise(gctx, 0, MADV_WILLNEED);
+
+    return 0;
+}
+
+// Philox4x32-10 counter-based generator: the output depends only on the
+// counter, so every row is generated independently of the others
+void gen_rand4(uint32_t row, uint32_t col, uint32_t stream, uint32_t r[4]) {
+    uint32_t key[2] = {(uint32_t)GEN_SEED, (uint32_t)(GEN_SEED >> 32)};
+
+    r[0] = row;
+    r[1] = col;
+    r[2] = stream;
+    r[3] = 0;
+    for (int round = 0; round < 10; round++) {
+        uint64_t p0 = (uint64_t)0xD2511F53u * r[0];
+        uint64_t p1 = (uint64_t)0xCD9E8D57u * r[2];
+
+        r[0] = (uint32_t)(p1 >> 32) ^ r[1] ^ key[0];
+        r[1] = (uint32_t)p1;
+        r[2] = (uint32_t)(p0 >> 32) ^ r[3] ^ key[1];
+        r[3] = (uint32_t)p0;
+
+        key[0] += 0x9E3779B9u;
+        key[1] += 0xBB67AE85u;
+    }
+}
+
+int gen_uniform(uint32_t r, int max) {
+    return (int)(r % (2u * max + 1)) - max;
+}
+
+int parse_gen_family(const char *name) {
+    if (strcmp(name, "random") == 0) return GEN_RANDOM;
+    if (strcmp(name, "tridiag") == 0) return GEN_TRIDIAG;
+    if (strcmp(name, "laplace") == 0) return GEN_LAPLACE;
+
+    return -1;
+}
+
+int parse_criterion(const char *name) {
+    if (strcmp(name, "update") == 0) return CRIT_UPDATE;
+    if (strcmp(name, "l2") == 0) return CRIT_L2;
+    if (strcmp(name, "linf") == 0) return CRIT_LINF;
+
+    return -1;
+}
+
+// Norm of b from the rows every rank owns, b may be known only partially
+void init_criterion(struct global_ctx_s *gctx) {
+    int size, rank;
+    double local = 0, norm = 0;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    for (uint32_t i = rank; i < gctx->n; i += size) {
+        if (gctx->criterion == CRIT_L2)
+            local += (double)gctx->b[i] * gctx->b[i];
+        else if (local < fabs((double) gctx->b[i]))
+            local = fabs((double) gctx->b[i]);
+    }
+
+    MPI_Allreduce(&local, &norm, 1, MPI_DOUBLE,
+                  gctx->criterion == CRIT_L2 ? MPI_SUM : MPI_MAX,
+                  MPI_COMM_WORLD);
+    if (gctx->criterion == CRIT_L2) norm = sqrt(norm);
+
+    gctx->b_norm = gctx->criterion == CRIT_UPDATE || norm == 0 ? 1 : norm;
+}
+
+void populate_row(struct global_ctx_s *gctx, uint32_t row, uint32_t grid) {
+    coef_t *A_row = &gctx->A[(uint64_t)row * gctx->n];
+    uint32_t r[4];
+
+    switch (gctx->gen_family) {
+        case GEN_RANDOM:
+            gen_rand4(row, 0, GEN_STREAM_B, r);
+            gctx->b[row] = gen_uniform(r[0], PARAM_ABS_MAX);
+
+            // Off-diagonal entries stay within PARAM_ABS_MAX and the diagonal grows
+            // with n, so the row is strictly diagonally dominant at any size
+            gen_rand4(row, 0, GEN_STREAM_DIAG, r);
+            int64_t diag = (int64_t)(gctx->n - 1) * PARAM_ABS_MAX + 1 +
+                           r[0] % PARAM_ABS_MAX;
+            A_row[row] = (coef_t)(r[1] & 1 ? diag : -diag);
+
+            for (uint32_t j = 0; j < gctx->n; j++) {
+                if (j % 4 == 0) gen_rand4(row, j / 4, GEN_STREAM_A, r);
+                if (j != row) A_row[j] = gen_uniform(r[j % 4], PARAM_ABS_MAX);
             }
-        }
+            break;
+
+        case GEN_TRIDIAG:
+            gen_rand4(row, 0, GEN_STREAM_B, r);
+            gctx->b[row] = gen_uniform(r[0], GEN_TRIDIAG_DIAG);
+
+            A_row[row] = GEN_TRIDIAG_DIAG;
+            coef_t nd = (coef_t)(gctx->gen_coupling * GEN_TRIDIAG_DIAG / 2);
+            if (row > 0) A_row[row - 1] = -nd;
+            if (row + 1 < gctx->n) A_row[row + 1] = -nd;
+            break;
+
+        case GEN_LAPLACE:
+            // 5-point stencil on a grid x grid mesh, rows numbered row by row
+            gen_rand4(row, 0, GEN_STREAM_B, r);
+            gctx->b[row] = gen_uniform(r[0], PARAM_ABS_MAX);
+
+            A_row[row] = 4;
+            if (row % grid != 0) A_row[row - 1] = -1;
+            if ((row + 1) % grid != 0) A_row[row + 1] = -1;
+            if (row >= grid) A_row[row - grid] = -1;
+            if (row + grid < gctx->n) A_row[row + grid] = -1;
+            break;
+    }
+}
+
+// Every rank generates only the rows it owns, no broadcast is needed
+int populate_ab(struct global_ctx_s *gctx) {
+    int size, rank;
+    uint32_t grid = (uint32_t)sqrt((double)gctx->n);
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    if (gctx->gen_family == GEN_LAPLACE && grid * grid != gctx->n) {
+        if (rank == 0)
+            fprintf(stderr, "Laplace system size must be a square, got %u\n",
+                    gctx->n);
+        return -1;
+    }
+
+    for (uint32_t row = rank; row < gctx->n; row += size) {
+        populate_row(gctx, row, grid);
     }
 
     return 0;
 }
 
 int init_gctx(struct global_ctx_s *gctx) {
-    gctx->A = malloc(sizeof(*gctx->A) * gctx->n * gctx->n);
-    if (gctx->A == NULL) return -ENOMEM;
-    memset(gctx->A, 0, sizeof(*gctx->A) * gctx->n * gctx->n);
+    // Zero pages from calloc, the rows of the other ranks are never touched
+    if (!gctx->stream) {
+        gctx->A = calloc(sizeof(*gctx->A), (uint64_t)gctx->n * gctx->n);
+        if (gctx->A == NULL) return -ENOMEM;
+    }
 
     gctx->X = calloc(sizeof(*gctx->X), gctx->n);
     if (gctx->X == NULL) return -ENOMEM;
-    memset(gctx->X, 0, sizeof(*gctx->X) * gctx->n);
+
+    gctx->X_prev = calloc(sizeof(*gctx->X_prev), gctx->n);
+    if (gctx->X_prev == NULL) return -ENOMEM;
 
     gctx->b = calloc(sizeof(*gctx->b), gctx->n);
     if (gctx->b == NULL) return -ENOMEM;
-    memset(gctx->b, 0, sizeof(*gctx->b) * gctx->n);
-
-    gctx->e = calloc(sizeof(*gctx->e), gctx->n);
-    if (gctx->e == NULL) return -ENOMEM;
-    for (int i = 0; i < gctx->n; i++) {
-        gctx->e[i] = DBL_MAX;
-    }
 
     return 0;
 }
@@ -221,28 +516,66 @@ int main(int argc, char **argv) {
     int ret, opt, rank, size;
     char *linear_system_path = NULL;
     char *linear_system_solve_path = NULL;
-    double cur_max_e;
+    char *linear_system_map_path = NULL;
+    char *linear_system_solve_bin_path = NULL;
+    bool check_residual = false;
+    double cur_max_e, r_l2, r_inf;
 
     MPI_Init(&argc, &argv);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-    struct global_ctx_s gctx = {
-        .n = 8, .max_e = 0.0000001, .i = 1, .w = 1.5, .run = 1};
+    struct global_ctx_s gctx = {.n = 8,
+                                .max_e = 0.0000001,
+                                .i = 1,
+                                .w = 1.5,
+                                .run = 1,
+                                .gen_family = GEN_RANDOM,
+                                .gen_coupling = 0.5,
+                                .criterion = CRIT_UPDATE};
     
-    while ((opt = getopt(argc, argv, "hc:o:n:w:e:")) != -1) {
+    while ((opt = getopt(argc, argv, "hc:m:s:g:k:o:O:rn:w:e:C:")) != -1) {
         switch (opt) {
             case 'h':
                 printf(
-                    "-c - file with linear system, -t - threads, -n - matrix "
-                    "size, -w - relax, -e - toler\n");
+                    "-c - file with linear system, -m - binary linear system "
+                    "file to stream from, -s - stream block rows, -g - "
+                    "generated system (random, tridiag, laplace), -k - "
+                    "tridiag coupling, -o - text "
+                    "solution file, -O - binary solution file, -r - report "
+                    "residual, -t - threads, -n - matrix size, -w - relax, "
+                    "-e - toler, -C - stop criterion (update, l2, linf)\n");
                 return 0;
             case 'c':
                 linear_system_path = optarg;
                 break;
+            case 'm':
+                linear_system_map_path = optarg;
+                gctx.stream = true;
+                break;
+            case 's':
+                gctx.stream_rows = atoi(optarg);
+                break;
+            case 'g':
+                ret = parse_gen_family(optarg);
+                if (ret < 0) {
+                    fprintf(stderr, "Unknown generated system %s\n", optarg);
+                    return 1;
+                }
+                gctx.gen_family = ret;
+                break;
+            case 'k':
+                gctx.gen_coupling = atof(optarg);
+                break;
             case 'o':
                 linear_system_solve_path = optarg;
                 break;
+            case 'O':
+                linear_system_solve_bin_path = optarg;
+                break;
+            case 'r':
+                check_residual = true;
+                break;
             case 'n':
                 gctx.n = atoi(optarg);
                 break;
@@ -252,6 +585,14 @@ int main(int argc, char **argv) {
             case 'e':
                 gctx.max_e = atof(optarg);
                 break;
+            case 'C':
+                ret = parse_criterion(optarg);
+                if (ret < 0) {
+                    fprintf(stderr, "Unknown stop criterion %s\n", optarg);
+                    return 1;
+                }
+                gctx.criterion = ret;
+                break;
 
             default:
                 return 1;
@@ -261,20 +602,33 @@ int main(int argc, char **argv) {
     ret = init_gctx(&gctx);
     if (ret < 0) return ret;
 
-    if (rank == 0) {
-        if (linear_system_path != NULL)
-            ret = populate_ab_from_file(&gctx, linear_system_path);
-        else
-            ret = populate_ab(&gctx);
-
+    if (gctx.stream) {
+        // Every rank maps the file itself instead of receiving a copy of A
+        ret = populate_ab_from_binary_file(&gctx, linear_system_map_path);
+        if (ret != 0) {
+            perror("Failed to populate linear system\n");
+            return ret;
+        }
+    } else if (linear_system_path == NULL) {
+        ret = populate_ab(&gctx);
         if (ret != 0) {
             perror("Failed to populate linear system\n");
             return ret;
         }
+    } else {
+        if (rank == 0) {
+            ret = populate_ab_from_file(&gctx, linear_system_path);
+            if (ret != 0) {
+                perror("Failed to populate linear system\n");
+                return ret;
+            }
+        }
+
+        MPI_Bcast(gctx.A, gctx.n * gctx.n, COEF_MPI, 0, MPI_COMM_WORLD);
+        MPI_Bcast(gctx.b, gctx.n, COEF_MPI, 0, MPI_COMM_WORLD);
     }
 
-    MPI_Bcast(gctx.A, gctx.n * gctx.n, MPI_INT, 0, MPI_COMM_WORLD);
-    MPI_Bcast(gctx.b, gctx.n, MPI_INT, 0, MPI_COMM_WORLD);
+    init_criterion(&gctx);
 
     // if (rank == 0) {
     //     printf("Linear system n = %d: \n", gctx.n);
@@ -288,11 +642,24 @@ int main(int argc, char **argv) {
     //     printf("max e = %g, w = %g\n", gctx.max_e, gctx.w);
     // }
 
+    // Sweeps only, without setup and generation, for the benchmark suite
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start = MPI_Wtime();
     ret = sor(&gctx, &cur_max_e);
+    double elapsed = MPI_Wtime() - start;
+    if (check_residual) residual(&gctx, &r_l2, &r_inf);
+
     if (rank == 0) {
         if (ret == 0) {
-            printf("Get result for %d iterations, max e %g\n", gctx.i,
-                   cur_max_e);
+            if (check_residual)
+                printf(
+                    "Get result for %d iterations, max e %g, residual l2 %g, "
+                    "linf %g\n",
+                    gctx.i, cur_max_e, r_l2, r_inf);
+            else
+                printf("Get result for %d iterations, max e %g\n", gctx.i,
+                       cur_max_e);
+            printf("Sweep time %g ms\n", elapsed * 1000 / gctx.i);
             // printf("X: \n");
             // for (int i = 0; i < gctx.n; i++) {
             //     printf("%.*f ", abs(log10(gctx.max_e)), gctx.X[i]);
@@ -312,6 +679,20 @@ int main(int argc, char **argv) {
                 fclose(f);
             }
 
+            if (linear_system_solve_bin_path != NULL) {
+                FILE *f = fopen(linear_system_solve_bin_path, "wb");
+                if (f == NULL) {
+                    perror("Filed to open linear_system_solve_bin_path");
+                    return -1;
+                }
+
+                // Always float64, whatever real_t is in this build
+                for (int i = 0; i < gctx.n; i++) {
+                    double x = gctx.X[i];
+                    fwrite(&x, sizeof(x), 1, f);
+                }
+                fclose(f);
+            }
         } else {
             printf("Reach limit of iterations: %d", ITERATIONS_MAX);
         }
@@ -8,43 +8,184 @@
 #include <memory.h>
 #include <unistd.h>
 #include <stdlib.h>
-#include <float.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <omp.h>
 
 
 #define PARAM_ABS_MAX 100
 #define ITERATIONS_MAX 10000
+#define STREAM_BLOCK_BYTES (64 << 20)
+#define TASK_SWEEPS 4
+#define TUNE_SWEEPS 10
+#define TUNE_W_SWEEPS 50
+#define TUNE_HOST_MAX 256
+
+// Element type of A and b, chosen at build time (make COEF=int|float|double)
+// so that every kernel is compiled for exactly one coefficient type. X and the
+// row sums are real_t, the same type as A in the float and double builds, so
+// their row products take no conversions. An int A has no real counterpart,
+// that build keeps X in double.
+#if defined(COEF_DOUBLE)
+typedef double coef_t;
+typedef double real_t;
+#define COEF_SCN "%lf"
+#define COEF_FMT "d"
+#define REAL_FMT "d"
+#elif defined(COEF_FLOAT)
+typedef float coef_t;
+typedef float real_t;
+#define COEF_SCN "%f"
+#define COEF_FMT "f"
+#define REAL_FMT "f"
+#else
+typedef int coef_t;
+typedef double real_t;
+#define COEF_SCN "%d"
+#define COEF_FMT "i"
+#define REAL_FMT "d"
+#endif
+
+#define GEN_SEED 1234567890ULL
+#define GEN_TRIDIAG_DIAG 1000000
+
+#define GEN_STREAM_A 0
+#define GEN_STREAM_B 1
+#define GEN_STREAM_DIAG 2
+
+enum gen_family_e {
+    GEN_RANDOM,
+    GEN_TRIDIAG,
+    GEN_LAPLACE,
+};
+
+// Stopping criteria: max |X_new - X_old|, or ||r|| / ||b|| in L2 or Linf.
+// The residual is exact for the iterate a sweep starts from, so it trails the
+// update by one sweep.
+enum criterion_e {
+    CRIT_UPDATE,
+    CRIT_L2,
+    CRIT_LINF,
+};
+
+static const char *criterion_names[] = {"update", "l2", "linf"};
 
 
 struct global_ctx_s {
     int i;
     bool run;
-    int **A;
+    coef_t **A;
     uint64_t n;
-    int *b;
-    double *e;
-    double *X;
+    coef_t *b;
+    real_t *X;
+    // Value of each X before its last update, for the lower part of the residual
+    real_t *X_prev;
     uint32_t *Xi;
     double max_e;
     double w;
 
     uint32_t threads_num;
+
+    int result_i;
+    double result_e;
+
+    enum gen_family_e gen_family;
+    double gen_coupling;
+
+    enum criterion_e criterion;
+    double b_norm;
+
+    // Rows are dealt to threads cyclically in chunks of chunk rows
+    uint32_t chunk;
+    int iterations_max;
+    double mid_e;
+
+    bool quiet;
+
+    // Task dataflow mode: rows are updated in blocks of task_rows rows, each
+    // block lists the other blocks it is coupled with through A, the ones
+    // before it first. Up to TASK_SWEEPS sweeps are in flight, each with its
+    // own slot of per-block errors and its own dependency token.
+    uint32_t task_rows;
+    uint64_t **deps;
+    uint64_t *deps_num;
+    uint64_t *deps_lower_num;
+    real_t *upper;
+    double *e_blk;
+    char sweep_dep[TASK_SWEEPS];
+
+    // Out-of-core mode: A rows point into a read-only mapping of the system
+    // file, which is swept in blocks of stream_rows rows.
+    coef_t *A_map;
+    size_t A_map_len;
+    uint64_t stream_rows;
 };
 
 
+void stream_madvise(struct global_ctx_s *gctx, uint64_t block, int advice) {
+    long page = sysconf(_SC_PAGESIZE);
+    uint64_t row_bytes = gctx->n * sizeof(*gctx->A_map);
+    uintptr_t base = (uintptr_t)gctx->A_map;
+    uintptr_t start = base + block * gctx->stream_rows * row_bytes;
+    uintptr_t end = start + gctx->stream_rows * row_bytes;
+
+    if (end > base + gctx->n * row_bytes)
+        end = base + gctx->n * row_bytes;
+
+    // Widen the range for prefetch, shrink it for release so that the
+    // pages shared with the neighbouring blocks stay resident.
+    if (advice == MADV_WILLNEED) {
+        start &= ~(page - 1);
+    } else {
+        start = (start + page - 1) & ~(page - 1);
+        end &= ~(page - 1);
+    }
+
+    if (start < end)
+        madvise((void *)start, end - start, advice);
+}
+
+void stream_advance(struct global_ctx_s *gctx, uint64_t block) {
+    uint64_t blocks = (gctx->n + gctx->stream_rows - 1) / gctx->stream_rows;
+
+    // Current block, the prefetched one and the released one must differ
+    if (blocks < 3)
+        return;
+
+    stream_madvise(gctx, (block + 1) % blocks, MADV_WILLNEED);
+    stream_madvise(gctx, (block + blocks - 1) % blocks, MADV_DONTNEED);
+}
+
+
+static inline int next_own_row(struct global_ctx_s *gctx, int row) {
+    if ((row + 1) % gctx->chunk != 0)
+        return row + 1;
+
+    return row + 1 + (gctx->threads_num - 1) * gctx->chunk;
+}
+
 void sor(struct global_ctx_s *gctx) {
-    int *b = gctx->b;
-    int **A = gctx->A;
-    double *X = gctx->X;
+    coef_t *b = gctx->b;
+    coef_t **A = gctx->A;
+    real_t *X = gctx->X;
+    real_t *X_prev = gctx->X_prev;
+    real_t w = gctx->w;
+    // Error of each thread's own rows in the sweep, combined in one pass
+    double e[gctx->threads_num];
     
-    #pragma omp parallel num_threads(gctx->threads_num) shared(b, A, X, gctx)
+    #pragma omp parallel num_threads(gctx->threads_num) shared(b, A, X, X_prev, w, e, gctx)
     { 
         int gi;
         int idx = omp_get_thread_num();  
 
-        int own_rows_num = gctx->n / gctx->threads_num +  (idx + 1 <= gctx->n % gctx->threads_num ? 1 : 0);
+        int own_rows_num = 0;
+        for (int row = idx * gctx->chunk; row < gctx->n; row = next_own_row(gctx, row))
+            own_rows_num++;
         
-        printf("Thread %d start, own_rows_num: %d\n", idx, own_rows_num);
+        if (!gctx->quiet)
+            printf("Thread %d start, own_rows_num: %d\n", idx, own_rows_num);
         #pragma omp atomic read
             gi = gctx->i;
         while(gi > 0) {
@@ -52,19 +193,26 @@ void sor(struct global_ctx_s *gctx) {
                 printf("Thread %d Iteration #%d\n", idx, gi);
             #endif
             
-            for (int row_i = 0; row_i < own_rows_num; row_i++)
+            double cur_e = 0;
+            for (int row = idx * gctx->chunk; row < gctx->n; row = next_own_row(gctx, row))
             {
-                int row = idx + gctx->threads_num * row_i;
+
+                if (gctx->A_map != NULL && row % gctx->stream_rows == 0)
+                    stream_advance(gctx, row / gctx->stream_rows);
                 
-                double old_X = X[row];
-                double fpart = (1 - gctx->w) * old_X;
+                real_t old_X = X[row];
+                real_t fpart = (1 - w) * old_X;
                 
-                double spart = b[row];
+                real_t spart = b[row];
                 for (int i = gctx->n - 1; i > row; i--)
                 {
                     spart -= A[row][i]*X[i];    
                 }
 
+                // The lower part is taken against both the new and the
+                // previous values, the latter gives the exact residual of
+                // the iterate this sweep started from
+                real_t rpart = spart;
                 for (int i = row - 1; i >= 0; i--)
                 {
                     int xii;
@@ -74,34 +222,56 @@ void sor(struct global_ctx_s *gctx) {
                         continue;
                     } while (xii != gi);
                     
-                    double xi;
+                    real_t xi, xpi;
                     #pragma omp atomic read
                     xi = X[i];
+                    #pragma omp atomic read
+                    xpi = X_prev[i];
                     spart -= A[row][i] * xi;
+                    rpart -= A[row][i] * xpi;
                 }
                 
-                spart = gctx->w * (spart / (double) A[row][row]);
+                real_t res = rpart - A[row][row] * old_X;
+
+                spart = w * (spart / (real_t) A[row][row]);
                 
+                #pragma omp atomic write
+                X_prev[row] = old_X;
                 #pragma omp atomic write
                 X[row] = fpart + spart;
                 #pragma omp atomic
                 gctx->Xi[row] += 1;
 
-                gctx->e[row] = fabs(old_X - X[row]);
+                double row_e = gctx->criterion == CRIT_UPDATE ? fabs(old_X - X[row]) : fabs(res);
+                if (gctx->criterion == CRIT_L2)
+                    cur_e += row_e * row_e;
+                else if (cur_e < row_e)
+                    cur_e = row_e;
             }
+            e[idx] = cur_e;
             
             #pragma omp barrier
             #pragma omp single copyprivate(gi)
             {
                 double cur_max_e = 0;
-                for (int i = 0; i < gctx->n; i++)
+                for (uint32_t t = 0; t < gctx->threads_num; t++)
                 {
-                    if(cur_max_e < gctx->e[i])
-                        cur_max_e = gctx->e[i];
+                    if (gctx->criterion == CRIT_L2)
+                        cur_max_e += e[t];
+                    else if(cur_max_e < e[t])
+                        cur_max_e = e[t];
                 }
 
-                if(cur_max_e < gctx->max_e || gctx->i >= ITERATIONS_MAX) {
-                    printf("Get result for %d iterations, max e %g\n", gctx->i, cur_max_e);
+                if (gctx->criterion == CRIT_L2)
+                    cur_max_e = sqrt(cur_max_e);
+                cur_max_e /= gctx->b_norm;
+
+                if (gctx->i == gctx->iterations_max / 2)
+                    gctx->mid_e = cur_max_e;
+
+                if(cur_max_e < gctx->max_e || gctx->i >= gctx->iterations_max) {
+                    gctx->result_i = gctx->i;
+                    gctx->result_e = cur_max_e;
                     gctx->i = - 1;
                 } else {
                     // printf("X: \n");
@@ -121,8 +291,490 @@ void sor(struct global_ctx_s *gctx) {
             }
         }
 
-        printf("Worker %d is finished\n", idx);
+        if (!gctx->quiet)
+            printf("Worker %d is finished\n", idx);
+    }
+}
+
+// Builds the block coupling lists from the nonzero pattern of A
+int init_tasks(struct global_ctx_s *gctx)
+{
+    uint64_t B = gctx->task_rows;
+    uint64_t blocks = (gctx->n + B - 1) / B;
+
+    gctx->deps = calloc(sizeof(*gctx->deps), blocks);
+    gctx->deps_num = calloc(sizeof(*gctx->deps_num), blocks);
+    gctx->deps_lower_num = calloc(sizeof(*gctx->deps_lower_num), blocks);
+    gctx->upper = calloc(sizeof(*gctx->upper), gctx->n);
+    gctx->e_blk = calloc(sizeof(*gctx->e_blk), TASK_SWEEPS * blocks);
+    if (gctx->deps == NULL || gctx->deps_num == NULL ||
+        gctx->deps_lower_num == NULL || gctx->upper == NULL || gctx->e_blk == NULL)
+        return -1;
+
+    #pragma omp parallel num_threads(gctx->threads_num)
+    {
+        uint8_t *mark = calloc(1, blocks);
+
+        #pragma omp for schedule(dynamic)
+        for (uint64_t blk = 0; blk < blocks; blk++)
+        {
+            uint64_t last = (blk + 1) * B < gctx->n ? (blk + 1) * B : gctx->n;
+            uint64_t num = 0;
+
+            for (uint64_t row = blk * B; row < last; row++)
+            {
+                for (uint64_t i = 0; i < gctx->n; i++)
+                {
+                    if (gctx->A[row][i] != 0 && i / B != blk && !mark[i / B]) {
+                        mark[i / B] = 1;
+                        num++;
+                    }
+                }
+            }
+
+            gctx->deps[blk] = calloc(sizeof(*gctx->deps[blk]), num);
+            for (uint64_t i = 0; i < blocks; i++)
+            {
+                if (mark[i]) {
+                    gctx->deps[blk][gctx->deps_num[blk]++] = i;
+                    if (i < blk)
+                        gctx->deps_lower_num[blk]++;
+                    mark[i] = 0;
+                }
+            }
+        }
+
+        free(mark);
+    }
+
+    return 0;
+}
+
+void free_tasks(struct global_ctx_s *gctx)
+{
+    uint64_t blocks = (gctx->n + gctx->task_rows - 1) / gctx->task_rows;
+
+    for (uint64_t blk = 0; blk < blocks; blk++)
+        free(gctx->deps[blk]);
+    free(gctx->deps);
+    free(gctx->deps_num);
+    free(gctx->deps_lower_num);
+    free(gctx->upper);
+    free(gctx->e_blk);
+}
+
+// Upper part of the row products of a block: the coupled blocks after it,
+// which still hold the previous sweep. Needs nothing from the current sweep.
+void sor_block_upper(struct global_ctx_s *gctx, uint64_t blk)
+{
+    uint64_t B = gctx->task_rows;
+    uint64_t first = blk * B;
+    uint64_t last = first + B < gctx->n ? first + B : gctx->n;
+    real_t *X = gctx->X;
+
+    for (uint64_t row = first; row < last; row++)
+    {
+        coef_t *A_row = gctx->A[row];
+        real_t upart = 0;
+
+        for (uint64_t d = gctx->deps_lower_num[blk]; d < gctx->deps_num[blk]; d++)
+        {
+            uint64_t dep_first = gctx->deps[blk][d] * B;
+            uint64_t dep_last = dep_first + B < gctx->n ? dep_first + B : gctx->n;
+
+            for (uint64_t i = dep_first; i < dep_last; i++)
+            {
+                upart += A_row[i] * X[i];
+            }
+        }
+
+        gctx->upper[row] = upart;
+    }
+}
+
+// SOR update of one block of rows on top of its upper part: the block
+// itself and the coupled blocks before it, already in the current sweep.
+void sor_block(struct global_ctx_s *gctx, uint64_t blk, double *e_blk)
+{
+    uint64_t B = gctx->task_rows;
+    uint64_t first = blk * B;
+    uint64_t last = first + B < gctx->n ? first + B : gctx->n;
+    real_t *X = gctx->X;
+    real_t *X_prev = gctx->X_prev;
+    real_t w = gctx->w;
+    double cur_e = 0;
+
+    for (uint64_t row = first; row < last; row++)
+    {
+        coef_t *A_row = gctx->A[row];
+
+        if (gctx->A_map != NULL && row % gctx->stream_rows == 0)
+            stream_advance(gctx, row / gctx->stream_rows);
+
+        real_t old_X = X[row];
+        real_t spart = gctx->b[row] - gctx->upper[row];
+        real_t rpart = 0;
+
+        for (uint64_t i = first; i < last; i++)
+        {
+            if (i != row)
+                spart -= A_row[i] * X[i];
+            if (i < row)
+                rpart += A_row[i] * (X[i] - X_prev[i]);
+        }
+
+        for (uint64_t d = 0; d < gctx->deps_lower_num[blk]; d++)
+        {
+            uint64_t dep_first = gctx->deps[blk][d] * B;
+            uint64_t dep_last = dep_first + B < gctx->n ? dep_first + B : gctx->n;
+
+            for (uint64_t i = dep_first; i < dep_last; i++)
+            {
+                spart -= A_row[i] * X[i];
+                rpart += A_row[i] * (X[i] - X_prev[i]);
+            }
+        }
+
+        // Residual of the iterate the sweep started from: the lower part
+        // is put back to the values before their update
+        real_t res = spart + rpart - A_row[row] * old_X;
+        X_prev[row] = old_X;
+        X[row] = (1 - w) * old_X + w * (spart / (real_t) A_row[row]);
+
+        double e = gctx->criterion == CRIT_UPDATE ? fabs(old_X - X[row]) : fabs(res);
+        if (gctx->criterion == CRIT_L2)
+            cur_e += e * e;
+        else if (cur_e < e)
+            cur_e = e;
+    }
+
+    *e_blk = cur_e;
+}
+
+// Every block of every sweep is two tasks. The upper one reads the blocks
+// after it (in), once the previous sweep has written them, into the block's
+// upper part (out). It does not wait for the current sweep, so it runs
+// alongside the dependency chain. The lower one finishes the block (inout)
+// from the blocks before it (in) in the current sweep. Sweeps pipeline
+// through the same graph: on banded A sweep k follows sweep k - 1 a few
+// blocks behind. The stop of a sweep is decided while the TASK_SWEEPS - 1
+// sweeps after it run.
+void sor_tasks(struct global_ctx_s *gctx)
+{
+    uint64_t B = gctx->task_rows;
+    uint64_t blocks = (gctx->n + B - 1) / B;
+
+    if (!gctx->quiet)
+        printf("Task mode: %lu blocks of %lu rows\n", blocks, B);
+
+    #pragma omp parallel num_threads(gctx->threads_num)
+    #pragma omp single
+    {
+        for (int k = 1; ; k++)
+        {
+            if (k <= gctx->iterations_max) {
+                double *e_blk = gctx->e_blk + (k % TASK_SWEEPS) * blocks;
+
+                for (uint64_t blk = 0; blk < blocks; blk++)
+                {
+                    uint64_t *deps = gctx->deps[blk];
+
+                    #pragma omp task firstprivate(blk, deps) \
+                        depend(iterator(j = gctx->deps_lower_num[blk] : gctx->deps_num[blk]), in: gctx->X[deps[j] * B]) \
+                        depend(out: gctx->upper[blk * B])
+                    sor_block_upper(gctx, blk);
+
+                    #pragma omp task firstprivate(blk, e_blk, deps) \
+                        depend(iterator(j = 0 : gctx->deps_lower_num[blk]), in: gctx->X[deps[j] * B]) \
+                        depend(in: gctx->upper[blk * B]) depend(inout: gctx->X[blk * B]) \
+                        depend(in: gctx->sweep_dep[k % TASK_SWEEPS])
+                    sor_block(gctx, blk, &e_blk[blk]);
+                }
+            }
+
+            int d = k - TASK_SWEEPS + 1;
+            if (d < 1)
+                continue;
+
+            #pragma omp taskwait depend(inout: gctx->sweep_dep[d % TASK_SWEEPS])
+
+            double *e_blk = gctx->e_blk + (d % TASK_SWEEPS) * blocks;
+            double cur_max_e = 0;
+            for (uint64_t blk = 0; blk < blocks; blk++)
+            {
+                if (gctx->criterion == CRIT_L2)
+                    cur_max_e += e_blk[blk];
+                else if (cur_max_e < e_blk[blk])
+                    cur_max_e = e_blk[blk];
+            }
+
+            if (gctx->criterion == CRIT_L2)
+                cur_max_e = sqrt(cur_max_e);
+            cur_max_e /= gctx->b_norm;
+
+            if (d == gctx->iterations_max / 2)
+                gctx->mid_e = cur_max_e;
+
+            // The sweeps already in flight are finished, not dropped
+            if (cur_max_e < gctx->max_e || d >= gctx->iterations_max) {
+                gctx->result_i = k < gctx->iterations_max ? k : gctx->iterations_max;
+                gctx->result_e = cur_max_e;
+                break;
+            }
+        }
+
+        #pragma omp taskwait
+    }
+}
+
+void solve(struct global_ctx_s *gctx)
+{
+    if (gctx->task_rows != 0)
+        sor_tasks(gctx);
+    else
+        sor(gctx);
+}
+
+// True residual r = b - AX of the current solution, one parallel pass over A
+void residual(struct global_ctx_s *gctx, double *r_l2, double *r_inf) {
+    double sum = 0, max = 0;
+
+    #pragma omp parallel for num_threads(gctx->threads_num) reduction(+:sum) reduction(max:max)
+    for (int row = 0; row < gctx->n; row++)
+    {
+        double r = gctx->b[row];
+        for (int i = 0; i < gctx->n; i++)
+        {
+            r -= gctx->A[row][i] * gctx->X[i];
+        }
+
+        sum += r * r;
+        if (max < fabs(r))
+            max = fabs(r);
+    }
+
+    *r_l2 = sqrt(sum);
+    *r_inf = max;
+}
+
+void reset_gctx(struct global_ctx_s *gctx)
+{
+    gctx->i = 1;
+    memset(gctx->X, 0, sizeof(*gctx->X) * gctx->n);
+    memset(gctx->Xi, 0, sizeof(*gctx->Xi) * gctx->n);
+}
+
+static uint64_t fnv_bytes(uint64_t h, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+
+    return h;
+}
+
+// FNV-1a over n, A and b, identifies the system in the tuning profile
+uint64_t fingerprint(struct global_ctx_s *gctx)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    h = (h ^ gctx->n) * 0x100000001b3ULL;
+    for (int row = 0; row < gctx->n; row++)
+    {
+        h = fnv_bytes(h, gctx->A[row], gctx->n * sizeof(coef_t));
+        h = fnv_bytes(h, &gctx->b[row], sizeof(coef_t));
+    }
+
+    return h;
+}
+
+// Run at most trial_sweeps sweeps from X = 0 with the current settings.
+// Returns seconds per sweep, *sweeps gets the estimated sweeps to converge
+// extrapolated from the criterion decay over the second half of the trial,
+// past the start-up transient.
+double tune_trial(struct global_ctx_s *gctx, int trial_sweeps, double *sweeps)
+{
+    reset_gctx(gctx);
+    gctx->iterations_max = trial_sweeps;
+
+    double start = omp_get_wtime();
+    solve(gctx);
+    double elapsed = omp_get_wtime() - start;
+
+    if (gctx->result_e < gctx->max_e) {
+        *sweeps = gctx->result_i;
+    } else {
+        int half = gctx->result_i - gctx->result_i / 2;
+        double rate = pow(gctx->result_e / gctx->mid_e, 1.0 / half);
+        if (!(rate < 1))
+            *sweeps = INFINITY;
+        else
+            *sweeps = gctx->result_i + log(gctx->max_e / gctx->result_e) / log(rate);
+    }
+
+    return elapsed / gctx->result_i;
+}
+
+int load_profile(struct global_ctx_s *gctx, char *path, char *host, uint64_t fp,
+                 uint32_t *task_rows)
+{
+    char line[TUNE_HOST_MAX + 128], line_host[TUNE_HOST_MAX], line_criterion[16];
+    uint64_t line_fp, line_n;
+    uint32_t threads_num, chunk, line_task_rows;
+    double w, line_e;
+    int found = -1;
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+
+    // Later lines win, so a re-tuned entry overrides the older one. w is
+    // scored by the sweeps to reach the tolerance under the stop criterion,
+    // so both are part of the key. task_rows is 0 when the spin kernel won.
+    // Lines of the older formats are skipped.
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "%255s %lx %lu %15s %lf %u %u %lf %u", line_host, &line_fp,
+                   &line_n, line_criterion, &line_e, &threads_num, &chunk, &w,
+                   &line_task_rows) != 9)
+            continue;
+
+        if (strcmp(line_host, host) == 0 && line_fp == fp && line_n == gctx->n &&
+            strcmp(line_criterion, criterion_names[gctx->criterion]) == 0 &&
+            line_e == gctx->max_e) {
+            gctx->threads_num = threads_num;
+            gctx->chunk = chunk;
+            gctx->w = w;
+            *task_rows = line_task_rows;
+            found = 0;
+        }
+    }
+    fclose(f);
+
+    return found;
+}
+
+int save_profile(struct global_ctx_s *gctx, char *path, char *host, uint64_t fp)
+{
+    FILE *f = fopen(path, "a");
+    if (f == NULL) {
+        perror("Filed to open tuning profile");
+        return -1;
+    }
+
+    fprintf(f, "%s %016lx %lu %s %.17g %u %u %g %u\n", host, fp, gctx->n,
+            criterion_names[gctx->criterion], gctx->max_e, gctx->threads_num,
+            gctx->chunk, gctx->w, gctx->task_rows);
+    fclose(f);
+
+    return 0;
+}
+
+// Switches the kernel, task_rows 0 is the spin kernel. The block coupling
+// lists are rebuilt when the task block size changes.
+int set_task_rows(struct global_ctx_s *gctx, uint32_t task_rows)
+{
+    if (gctx->task_rows == task_rows)
+        return 0;
+
+    if (gctx->task_rows != 0)
+        free_tasks(gctx);
+    gctx->task_rows = task_rows;
+    return task_rows != 0 ? init_tasks(gctx) : 0;
+}
+
+// Pick w by the estimated sweeps to converge, then the kernel, threads and the
+// row tiling by the time per sweep with that w: the spin kernel over rows per
+// chunk and the task kernel over rows per block. The winner is cached per
+// system, host, stop criterion and tolerance.
+int autotune(struct global_ctx_s *gctx, char *path)
+{
+    static const uint32_t chunks[] = {1, 4, 16, 64};
+    static const uint32_t blocks[] = {16, 64, 256, 1024};
+    char host[TUNE_HOST_MAX] = "unknown";
+    double max_e = gctx->max_e;
+    double best, sweeps, t;
+    uint32_t task_rows;
+
+    gethostname(host, sizeof(host) - 1);
+    uint64_t fp = fingerprint(gctx);
+
+    if (load_profile(gctx, path, host, fp, &task_rows) == 0) {
+        printf("Tuning profile hit: threads %u, chunk %u, task rows %u, w %g\n",
+               gctx->threads_num, gctx->chunk, task_rows, gctx->w);
+        return set_task_rows(gctx, task_rows);
+    }
+
+    // Both kernels take the same sweeps, w is tuned on the spin one
+    if (set_task_rows(gctx, 0) != 0)
+        return -1;
+
+    double best_w = gctx->w;
+    best = INFINITY;
+    for (double w = 1.0; w < 1.95; w += 0.1)
+    {
+        gctx->w = w;
+        tune_trial(gctx, TUNE_W_SWEEPS, &sweeps);
+        printf("Tuning w %g: %g sweeps\n", w, sweeps);
+        if (sweeps < best) {
+            best = sweeps;
+            best_w = w;
+        }
+    }
+    gctx->w = best_w;
+
+    // Fixed-length trials, only the sweep time matters here
+    gctx->max_e = 0;
+
+    uint32_t best_threads = gctx->threads_num, best_chunk = gctx->chunk, best_task_rows = 0;
+    uint32_t procs = omp_get_num_procs();
+    best = INFINITY;
+    for (int task = 0; task < 2; task++)
+    {
+        const uint32_t *tiles = task ? blocks : chunks;
+        size_t tiles_num = task ? sizeof(blocks) / sizeof(*blocks) : sizeof(chunks) / sizeof(*chunks);
+        const char *tile_name = task ? "task rows" : "chunk";
+
+        for (size_t i = 0; i < tiles_num; i++)
+        {
+            // Blocks are rebuilt once per size, before the thread counts
+            if (i > 0 && tiles[i] >= gctx->n)
+                continue;
+            if (set_task_rows(gctx, task ? tiles[i] : 0) != 0)
+                return -1;
+
+            // Powers of two, then all the processors
+            for (uint32_t threads_num = 1; threads_num <= procs; threads_num = threads_num == procs ? procs + 1 : threads_num * 2 < procs ? threads_num * 2 : procs)
+            {
+                if (!task && i > 0 && tiles[i] * threads_num > gctx->n)
+                    continue;
+
+                gctx->threads_num = threads_num;
+                if (!task)
+                    gctx->chunk = tiles[i];
+                t = tune_trial(gctx, TUNE_SWEEPS, &sweeps);
+                printf("Tuning threads %u %s %u: %g s/sweep\n", threads_num, tile_name, tiles[i], t);
+                if (t < best) {
+                    best = t;
+                    best_threads = threads_num;
+                    if (task)
+                        best_task_rows = tiles[i];
+                    else
+                        best_chunk = tiles[i];
+                }
+            }
+        }
     }
+
+    gctx->threads_num = best_threads;
+    gctx->chunk = best_chunk;
+    if (set_task_rows(gctx, best_task_rows) != 0)
+        return -1;
+    gctx->max_e = max_e;
+
+    printf("Tuned: threads %u, chunk %u, task rows %u, w %g\n",
+           gctx->threads_num, gctx->chunk, gctx->task_rows, gctx->w);
+    return save_profile(gctx, path, host, fp);
 }
 
 int count_digits(int n) {
@@ -141,87 +793,370 @@ int populate_ab_from_file(struct global_ctx_s *gctx, char *path) {
 
     for (int i = 0; i < gctx->n; i++) {
         for (int j = 0; j < gctx->n; j++) {
-            fscanf(f, "%d", &gctx->A[i][j]);
+            if (fscanf(f, COEF_SCN, &gctx->A[i][j]) != 1) {
+                fprintf(stderr, "Bad coefficient at row %d, column %d\n", i, j);
+                fclose(f);
+                return -1;
+            }
+        }
+        if (fscanf(f, COEF_SCN, &gctx->b[i]) != 1) {
+            fprintf(stderr, "Bad right-hand side at row %d\n", i);
+            fclose(f);
+            return -1;
         }
-        fscanf(f, "%d", &gctx->b[i]);
     }
     fclose(f);
 
     return 0;
 }
 
-int populate_ab(struct global_ctx_s *gctx) {
-    uint32_t new_max;
+int populate_ab_from_binary_file(struct global_ctx_s *gctx, char *path) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Filed to open file");
+        return -1;
+    }
 
-    // srand(time(NULL));
-    srand(1234567890);
-    for (int i = 0; i < gctx->n; i++) {
-        gctx->b[i] = rand() % (2 * PARAM_ABS_MAX + 1) - PARAM_ABS_MAX;
-        while (gctx->A[i][i] == 0)
-            gctx->A[i][i] = rand() % (2 * PARAM_ABS_MAX + 1) - PARAM_ABS_MAX;
+    gctx->A_map_len = sizeof(*gctx->A_map) * (gctx->n * gctx->n + gctx->n);
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size != gctx->A_map_len) {
+        fprintf(stderr, "Binary system must hold %lu values of %lu bytes\n",
+                gctx->n * gctx->n + gctx->n, sizeof(coef_t));
+        close(fd);
+        return -1;
+    }
 
-        new_max = (uint32_t) (abs(gctx->A[i][i]) / (double) (gctx->n - 1) - 1);
+    gctx->A_map = mmap(NULL, gctx->A_map_len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (gctx->A_map == MAP_FAILED) {
+        gctx->A_map = NULL;
+        perror("Filed to map file");
+        return -1;
+    }
 
-        for (int j = 0; j < gctx->n; j++) {
-            if (i != j) {
-                gctx->A[i][j] = rand() % (2 * new_max + 1) - new_max;
-            }
+    for (int i = 0; i < gctx->n; i++)
+        gctx->A[i] = gctx->A_map + i * gctx->n;
+
+    memcpy(gctx->b, gctx->A_map + gctx->n * gctx->n, sizeof(*gctx->b) * gctx->n);
+    madvise(gctx->A_map, gctx->A_map_len, MADV_DONTNEED);
+
+    if (gctx->stream_rows == 0)
+        gctx->stream_rows = STREAM_BLOCK_BYTES / (gctx->n * sizeof(*gctx->A_map));
+    if (gctx->stream_rows == 0)
+        gctx->stream_rows = 1;
+    stream_madvise(gctx, 0, MADV_WILLNEED);
+
+    return 0;
+}
+
+// Philox4x32-10 counter-based generator: the output depends only on the
+// counter, so every row is generated independently of the others
+void gen_rand4(uint32_t row, uint32_t col, uint32_t stream, uint32_t r[4]) {
+    uint32_t key[2] = {(uint32_t)GEN_SEED, (uint32_t)(GEN_SEED >> 32)};
+
+    r[0] = row;
+    r[1] = col;
+    r[2] = stream;
+    r[3] = 0;
+    for (int round = 0; round < 10; round++) {
+        uint64_t p0 = (uint64_t)0xD2511F53u * r[0];
+        uint64_t p1 = (uint64_t)0xCD9E8D57u * r[2];
+
+        r[0] = (uint32_t)(p1 >> 32) ^ r[1] ^ key[0];
+        r[1] = (uint32_t)p1;
+        r[2] = (uint32_t)(p0 >> 32) ^ r[3] ^ key[1];
+        r[3] = (uint32_t)p0;
+
+        key[0] += 0x9E3779B9u;
+        key[1] += 0xBB67AE85u;
+    }
+}
+
+int gen_uniform(uint32_t r, int max) {
+    return (int)(r % (2u * max + 1)) - max;
+}
+
+int parse_gen_family(const char *name) {
+    if (strcmp(name, "random") == 0)
+        return GEN_RANDOM;
+    if (strcmp(name, "tridiag") == 0)
+        return GEN_TRIDIAG;
+    if (strcmp(name, "laplace") == 0)
+        return GEN_LAPLACE;
+
+    return -1;
+}
+
+int parse_criterion(const char *name) {
+    if (strcmp(name, "update") == 0)
+        return CRIT_UPDATE;
+    if (strcmp(name, "l2") == 0)
+        return CRIT_L2;
+    if (strcmp(name, "linf") == 0)
+        return CRIT_LINF;
+
+    return -1;
+}
+
+void init_criterion(struct global_ctx_s *gctx) {
+    double norm = 0;
+
+    for (int i = 0; i < gctx->n; i++)
+    {
+        if (gctx->criterion == CRIT_L2)
+            norm += (double) gctx->b[i] * gctx->b[i];
+        else if (norm < fabs((double) gctx->b[i]))
+            norm = fabs((double) gctx->b[i]);
+    }
+
+    if (gctx->criterion == CRIT_L2)
+        norm = sqrt(norm);
+
+    gctx->b_norm = gctx->criterion == CRIT_UPDATE || norm == 0 ? 1 : norm;
+}
+
+void populate_row(struct global_ctx_s *gctx, uint64_t row, uint64_t grid) {
+    coef_t *A_row = gctx->A[row];
+    uint32_t r[4];
+
+    switch (gctx->gen_family) {
+    case GEN_RANDOM:
+        gen_rand4(row, 0, GEN_STREAM_B, r);
+        gctx->b[row] = gen_uniform(r[0], PARAM_ABS_MAX);
+
+        // Off-diagonal entries stay within PARAM_ABS_MAX and the diagonal grows
+        // with n, so the row is strictly diagonally dominant at any size
+        gen_rand4(row, 0, GEN_STREAM_DIAG, r);
+        int64_t diag = (int64_t)(gctx->n - 1) * PARAM_ABS_MAX + 1 +
+                       r[0] % PARAM_ABS_MAX;
+        A_row[row] = (coef_t)(r[1] & 1 ? diag : -diag);
+
+        for (uint64_t j = 0; j < gctx->n; j++) {
+            if (j % 4 == 0)
+                gen_rand4(row, j / 4, GEN_STREAM_A, r);
+            if (j != row)
+                A_row[j] = gen_uniform(r[j % 4], PARAM_ABS_MAX);
         }
+        break;
+
+    case GEN_TRIDIAG:
+        gen_rand4(row, 0, GEN_STREAM_B, r);
+        gctx->b[row] = gen_uniform(r[0], GEN_TRIDIAG_DIAG);
+
+        A_row[row] = GEN_TRIDIAG_DIAG;
+        coef_t nd = (coef_t)(gctx->gen_coupling * GEN_TRIDIAG_DIAG / 2);
+        if (row > 0)
+            A_row[row - 1] = -nd;
+        if (row + 1 < gctx->n)
+            A_row[row + 1] = -nd;
+        break;
+
+    case GEN_LAPLACE:
+        // 5-point stencil on a grid x grid mesh, rows numbered row by row
+        gen_rand4(row, 0, GEN_STREAM_B, r);
+        gctx->b[row] = gen_uniform(r[0], PARAM_ABS_MAX);
+
+        A_row[row] = 4;
+        if (row % grid != 0)
+            A_row[row - 1] = -1;
+        if ((row + 1) % grid != 0)
+            A_row[row + 1] = -1;
+        if (row >= grid)
+            A_row[row - grid] = -1;
+        if (row + grid < gctx->n)
+            A_row[row + grid] = -1;
+        break;
+    }
+}
+
+int gen_grid(struct global_ctx_s *gctx, uint64_t *grid) {
+    *grid = (uint64_t) sqrt((double) gctx->n);
+
+    if (gctx->gen_family == GEN_LAPLACE && *grid * *grid != gctx->n) {
+        fprintf(stderr, "Laplace system size must be a square, got %lu\n", gctx->n);
+        return -1;
+    }
+
+    return 0;
+}
+
+int populate_ab(struct global_ctx_s *gctx) {
+    uint64_t grid;
+
+    if (gen_grid(gctx, &grid) != 0)
+        return -1;
+
+    #pragma omp parallel for num_threads(gctx->threads_num) schedule(static, 1)
+    for (uint64_t row = 0; row < gctx->n; row++)
+    {
+        populate_row(gctx, row, grid);
     }
 
     return 0;
 }
 
-void init_gctx(struct global_ctx_s *gctx)
+// Writes the generated system in the binary layout of -m, block by block
+// through one buffer of stream_rows rows, so that A never has to fit in memory
+int dump_ab_to_binary_file(struct global_ctx_s *gctx, char *path) {
+    uint64_t grid, rows = gctx->stream_rows;
+    int ret = 0;
+
+    if (gen_grid(gctx, &grid) != 0)
+        return -1;
+
+    if (rows == 0)
+        rows = STREAM_BLOCK_BYTES / (gctx->n * sizeof(coef_t));
+    if (rows == 0)
+        rows = 1;
+    if (rows > gctx->n)
+        rows = gctx->n;
+
+    coef_t *block = malloc(sizeof(*block) * rows * gctx->n);
+    if (block == NULL)
+        return -1;
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        perror("Filed to open file");
+        free(block);
+        return -1;
+    }
+
+    for (uint64_t first = 0; first < gctx->n && ret == 0; first += rows)
+    {
+        uint64_t last = first + rows < gctx->n ? first + rows : gctx->n;
+
+        memset(block, 0, sizeof(*block) * (last - first) * gctx->n);
+        for (uint64_t row = first; row < last; row++)
+            gctx->A[row] = block + (row - first) * gctx->n;
+
+        #pragma omp parallel for num_threads(gctx->threads_num) schedule(static, 1)
+        for (uint64_t row = first; row < last; row++)
+        {
+            populate_row(gctx, row, grid);
+        }
+
+        if (fwrite(block, sizeof(*block), (last - first) * gctx->n, f) != (last - first) * gctx->n)
+            ret = -1;
+
+        for (uint64_t row = first; row < last; row++)
+            gctx->A[row] = NULL;
+    }
+
+    if (ret == 0 && fwrite(gctx->b, sizeof(*gctx->b), gctx->n, f) != gctx->n)
+        ret = -1;
+    if (fclose(f) != 0)
+        ret = -1;
+    if (ret != 0)
+        perror("Filed to write binary system");
+
+    free(block);
+    return ret;
+}
+
+void init_gctx(struct global_ctx_s *gctx, bool stream)
 {
+    // Rows come from calloc untouched, the generator threads fault them in
     gctx->A = calloc(sizeof(*gctx->A), gctx->n);
-    for (int i = 0; i < gctx->n; i++)
+    for (int i = 0; i < gctx->n && !stream; i++)
     {
         gctx->A[i]= calloc(sizeof(*gctx->A[i]), gctx->n);
-        memset(gctx->A[i], 0, sizeof(*gctx->A[i]) * gctx->n);
     }
     
     gctx->X = calloc(sizeof(*gctx->X), gctx->n);
-    memset(gctx->X, 0, sizeof(*gctx->X) * gctx->n);
+
+    gctx->X_prev = calloc(sizeof(*gctx->X_prev), gctx->n);
     
     gctx->b = calloc(sizeof(*gctx->b), gctx->n);
-    memset(gctx->b, 0, sizeof(*gctx->b) * gctx->n);
-
-    gctx->e = calloc(sizeof(*gctx->e), gctx->n);
-    memset(gctx->e, DBL_MAX, sizeof(*gctx->e) * gctx->n);
 
     gctx->Xi = calloc(sizeof(*gctx->Xi), gctx->n);
-    memset(gctx->Xi, 0, sizeof(*gctx->Xi) * gctx->n);
 }
 
+// The Python extension includes this file for the solver core only
+#ifndef SOR_NO_MAIN
 int main(int argc, char *argv[]) {
     int ret, opt;
     char *linear_system_path = NULL;
     char *linear_system_solve_path = NULL;
+    char *linear_system_map_path = NULL;
+    char *linear_system_solve_bin_path = NULL;
+    char *tune_profile_path = NULL;
+    char *linear_system_dump_path = NULL;
+    bool check_residual = false;
     struct global_ctx_s gctx = {
         .threads_num = 4,
         .n = 8,
         .max_e = 0.0000001,
         .i = 1,
-        .w = 1.5
+        .w = 1.5,
+        .gen_family = GEN_RANDOM,
+        .gen_coupling = 0.5,
+        .criterion = CRIT_UPDATE,
+        .chunk = 1,
+        .iterations_max = ITERATIONS_MAX
     };
 
-    while ((opt = getopt(argc, argv, "hc:o:t:n:w:e:")) != -1) {
+    while ((opt = getopt(argc, argv, "hc:m:s:g:k:D:o:O:rt:p:T:a:n:w:e:C:")) != -1) {
         switch (opt) {
             case 'h':
                 printf(
-                    "-c - file with linear system, -t - threads, -n - matrix "
-                    "size, -w - relax, -e - toler\n");
+                    "-c - file with linear system, -m - binary linear system "
+                    "file to stream from, -s - stream block rows, -g - "
+                    "generated system (random, tridiag, laplace), -k - "
+                    "tridiag coupling, -D - write the generated system "
+                    "to a binary file for -m and exit, -o - text "
+                    "solution file, -O - binary solution file, -r - report "
+                    "residual, -t - threads, -p - rows per chunk, -T - rows "
+                    "per task (task dataflow mode), -a - "
+                    "autotune kernel, w, threads and tiling with profile "
+                    "file, -n - matrix size, -w - "
+                    "relax, -e - toler, -C - stop criterion (update, l2, "
+                    "linf)\n");
                 return 0;
             case 'c':
                 linear_system_path = optarg;
                 break;
+            case 'm':
+                linear_system_map_path = optarg;
+                break;
+            case 's':
+                gctx.stream_rows = atoi(optarg);
+                break;
+            case 'g':
+                ret = parse_gen_family(optarg);
+                if (ret < 0) {
+                    fprintf(stderr, "Unknown generated system %s\n", optarg);
+                    return 1;
+                }
+                gctx.gen_family = ret;
+                break;
+            case 'k':
+                gctx.gen_coupling = atof(optarg);
+                break;
+            case 'D':
+                linear_system_dump_path = optarg;
+                break;
             case 'o':
                 linear_system_solve_path = optarg;
                 break;
+            case 'O':
+                linear_system_solve_bin_path = optarg;
+                break;
+            case 'r':
+                check_residual = true;
+                break;
             case 't':
                 gctx.threads_num = atoi(optarg);
                 break;
+            case 'p':
+                gctx.chunk = atoi(optarg);
+                break;
+            case 'T':
+                gctx.task_rows = atoi(optarg);
+                break;
+            case 'a':
+                tune_profile_path = optarg;
+                break;
             case 'n':
                 gctx.n = atoi(optarg);
                 break;
@@ -231,6 +1166,14 @@ int main(int argc, char *argv[]) {
             case 'e':
                 gctx.max_e = atof(optarg);
                 break;
+            case 'C':
+                ret = parse_criterion(optarg);
+                if (ret < 0) {
+                    fprintf(stderr, "Unknown stop criterion %s\n", optarg);
+                    return 1;
+                }
+                gctx.criterion = ret;
+                break;
 
             default:
                 return 1;
@@ -240,9 +1183,14 @@ int main(int argc, char *argv[]) {
     omp_set_num_threads(gctx.threads_num);
     omp_set_dynamic(0);
 
-    init_gctx(&gctx);
+    init_gctx(&gctx, linear_system_map_path != NULL || linear_system_dump_path != NULL);
+
+    if (linear_system_dump_path != NULL)
+        return dump_ab_to_binary_file(&gctx, linear_system_dump_path) != 0;
 
-    if (linear_system_path != NULL)
+    if (linear_system_map_path != NULL)
+        ret = populate_ab_from_binary_file(&gctx, linear_system_map_path);
+    else if (linear_system_path != NULL)
         ret = populate_ab_from_file(&gctx, linear_system_path);
     else
         ret = populate_ab(&gctx);
@@ -252,6 +1200,22 @@ int main(int argc, char *argv[]) {
         return ret;
     }
 
+    init_criterion(&gctx);
+
+    if (gctx.task_rows != 0 && init_tasks(&gctx) != 0) {
+        perror("Failed to init tasks\n");
+        return -1;
+    }
+
+    if (tune_profile_path != NULL) {
+        ret = autotune(&gctx, tune_profile_path);
+        if (ret != 0)
+            return ret;
+
+        reset_gctx(&gctx);
+        gctx.iterations_max = ITERATIONS_MAX;
+    }
+
     // printf("Linear system n = %d: \n", gctx.n);
     // for (int i = 0; i < gctx.n ; i++)
     // {
@@ -263,9 +1227,27 @@ int main(int argc, char *argv[]) {
     // }
     // printf("max e = %g, w = %g\n", gctx.max_e, gctx.w);
 
+    // Sweeps only, without setup and generation, for the benchmark suite
+    double start = omp_get_wtime();
+    solve(&gctx);
+    double elapsed = omp_get_wtime() - start;
 
-    sor(&gctx);
-    
+    // Cut off by the iterations limit: reported as a failure and no solution
+    // is written, like the other backends do
+    if (!(gctx.result_e < gctx.max_e)) {
+        printf("Failed to solve, reached iterations limit %d\n", gctx.iterations_max);
+        return 0;
+    }
+
+    if (check_residual) {
+        double r_l2, r_inf;
+        residual(&gctx, &r_l2, &r_inf);
+        printf("Get result for %d iterations, max e %g, residual l2 %g, linf %g\n",
+               gctx.result_i, gctx.result_e, r_l2, r_inf);
+    } else {
+        printf("Get result for %d iterations, max e %g\n", gctx.result_i, gctx.result_e);
+    }
+    printf("Sweep time %g ms\n", elapsed * 1000 / gctx.result_i);
     
     // printf("X: \n");
     // for (int i = 0; i < gctx.n; i++)
@@ -286,7 +1268,23 @@ int main(int argc, char *argv[]) {
         }
         fclose(f);
     }
+
+    if (linear_system_solve_bin_path != NULL) {
+        FILE *f = fopen(linear_system_solve_bin_path, "wb");
+        if (f == NULL) {
+            perror("Filed to open linear_system_solve_bin_path");
+            return -1;
+        }
+
+        // Always float64, whatever real_t is in this build
+        for (int i = 0; i < gctx.n; i++) {
+            double x = gctx.X[i];
+            fwrite(&x, sizeof(x), 1, f);
+        }
+        fclose(f);
+    }
     
 
     return 0;
 }
+#endif
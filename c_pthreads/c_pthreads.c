@@ -1,4 +1,4 @@
-#include <float.h>
+#include <fcntl.h>
 #include <malloc.h>
 #include <math.h>
 #include <memory.h>
@@ -8,20 +8,86 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #define PARAM_ABS_MAX 100
 #define ITERATIONS_MAX 100000
+#define STREAM_BLOCK_BYTES (64 << 20)
+#define TREE_FANIN 4
+#define CACHE_LINE 64
+
+// Element type of A and b, chosen at build time (make COEF=int|float|double)
+// so that every kernel is compiled for exactly one coefficient type. X and the
+// row sums are real_t, the same type as A in the float and double builds, so
+// their row products take no conversions. An int A has no real counterpart,
+// that build keeps X in double.
+#if defined(COEF_DOUBLE)
+typedef double coef_t;
+typedef double real_t;
+#define COEF_SCN "%lf"
+#elif defined(COEF_FLOAT)
+typedef float coef_t;
+typedef float real_t;
+#define COEF_SCN "%f"
+#else
+typedef int coef_t;
+typedef double real_t;
+#define COEF_SCN "%d"
+#endif
+
+#define GEN_SEED 1234567890ULL
+#define GEN_TRIDIAG_DIAG 1000000
+
+#define GEN_STREAM_A 0
+#define GEN_STREAM_B 1
+#define GEN_STREAM_DIAG 2
+
+enum gen_family_e {
+    GEN_RANDOM,
+    GEN_TRIDIAG,
+    GEN_LAPLACE,
+};
+
+// Stopping criteria: max |X_new - X_old|, or ||r|| / ||b|| in L2 or Linf.
+// The residual is exact for the iterate a sweep starts from, so it trails the
+// update by one sweep.
+enum criterion_e {
+    CRIT_UPDATE,
+    CRIT_L2,
+    CRIT_LINF,
+};
 
 
+// Node of the combining tree barrier ending every sweep. Up to TREE_FANIN
+// children post their error to e[], the last one to arrive combines them and
+// climbs to the parent. The root decides whether to go on, the decision comes
+// back down as every climber flips the sense of the node it came from. Each
+// node sits on its own cache line, so at most TREE_FANIN threads spin on it.
+struct tree_node_s {
+    atomic_uint count;
+    atomic_bool sense;
+    bool run;
+    uint32_t children;
+    struct tree_node_s *parent;
+    uint32_t parent_slot;
+    double e[TREE_FANIN];
+} __attribute__((aligned(CACHE_LINE)));
+
 struct global_ctx_s {
-    atomic_int i;
-    atomic_bool run;
-    int **A;
+    // First sweep number, then the last sweep run
+    int i;
+    double result_e;
+    bool success;
+    coef_t **A;
     uint64_t n;
-    int *b;
-    _Atomic double *e;
-    _Atomic double *X;
+    coef_t *b;
+    _Atomic real_t *X;
+    // Value of each X before its last update, for the lower part of the residual
+    _Atomic real_t *X_prev;
     atomic_uint *Xi;
     double max_e;
     double w;
@@ -29,60 +95,227 @@ struct global_ctx_s {
     uint32_t threads_num;
     pthread_t *threads;
 
-    struct tctx_s *tctxs
+    struct tctx_s *tctxs;
+
+    struct tree_node_s *tree;
+
+    // Out-of-core mode: A rows point into a read-only mapping of the system
+    // file, which is swept in blocks of stream_rows rows.
+    coef_t *A_map;
+    size_t A_map_len;
+    uint64_t stream_rows;
+
+    bool residual;
+
+    enum gen_family_e gen_family;
+    double gen_coupling;
+    uint64_t gen_grid;
+
+    enum criterion_e criterion;
+    double b_norm;
 };
 
 struct tctx_s {
     struct global_ctx_s *gctx;
     uint32_t idx;
+    bool sense;
+
+    // Own rows' part of the true residual b - AX
+    double r_sum;
+    double r_max;
 };
 
+void stream_madvise(struct global_ctx_s *gctx, uint64_t block, int advice) {
+    long page = sysconf(_SC_PAGESIZE);
+    uint64_t row_bytes = gctx->n * sizeof(*gctx->A_map);
+    uintptr_t base = (uintptr_t)gctx->A_map;
+    uintptr_t start = base + block * gctx->stream_rows * row_bytes;
+    uintptr_t end = start + gctx->stream_rows * row_bytes;
+
+    if (end > base + gctx->n * row_bytes) end = base + gctx->n * row_bytes;
+
+    // Widen the range for prefetch, shrink it for release so that the
+    // pages shared with the neighbouring blocks stay resident.
+    if (advice == MADV_WILLNEED) {
+        start &= ~(page - 1);
+    } else {
+        start = (start + page - 1) & ~(page - 1);
+        end &= ~(page - 1);
+    }
+
+    if (start < end) madvise((void *)start, end - start, advice);
+}
+
+void stream_advance(struct global_ctx_s *gctx, uint64_t block) {
+    uint64_t blocks = (gctx->n + gctx->stream_rows - 1) / gctx->stream_rows;
+
+    // Current block, the prefetched one and the released one must differ
+    if (blocks < 3) return;
+
+    stream_madvise(gctx, (block + 1) % blocks, MADV_WILLNEED);
+    stream_madvise(gctx, (block + blocks - 1) % blocks, MADV_DONTNEED);
+}
+
+// Called by the thread completing the tree with the combined error of sweep gi
+bool tree_decide(struct global_ctx_s *gctx, double e, int gi) {
+    if (gctx->criterion == CRIT_L2) e = sqrt(e);
+    e /= gctx->b_norm;
+
+    gctx->i = gi;
+    gctx->result_e = e;
+
+    if (gi + 1 >= ITERATIONS_MAX) {
+        gctx->success = false;
+        return false;
+    }
+
+    return !(e < gctx->max_e);
+}
+
+// Post e to the slot of node and wait for the sweep decision
+bool tree_arrive(struct global_ctx_s *gctx, struct tree_node_s *node,
+                 uint32_t slot, double e, bool sense, int gi) {
+    node->e[slot] = e;
+
+    if (atomic_fetch_add(&node->count, 1) + 1 < node->children) {
+        while (atomic_load(&node->sense) != sense) {
+            continue;
+        }
+        return node->run;
+    }
+
+    double combined = node->e[0];
+    for (uint32_t k = 1; k < node->children; k++) {
+        if (gctx->criterion == CRIT_L2)
+            combined += node->e[k];
+        else if (combined < node->e[k])
+            combined = node->e[k];
+    }
+
+    atomic_store(&node->count, 0);
+    if (node->parent != NULL)
+        node->run = tree_arrive(gctx, node->parent, node->parent_slot,
+                                combined, sense, gi);
+    else
+        node->run = tree_decide(gctx, combined, gi);
+    atomic_store(&node->sense, sense);
+
+    return node->run;
+}
+
+// Levels of ceil(width / TREE_FANIN) nodes from the leaves up to one root,
+// thread t arrives at leaf t / TREE_FANIN
+int init_tree(struct global_ctx_s *gctx) {
+    uint32_t nodes_num = 0;
+    uint32_t width = gctx->threads_num;
+    do {
+        width = (width + TREE_FANIN - 1) / TREE_FANIN;
+        nodes_num += width;
+    } while (width > 1);
+
+    gctx->tree = memalign(CACHE_LINE, sizeof(*gctx->tree) * nodes_num);
+    if (gctx->tree == NULL) return -1;
+    memset(gctx->tree, 0, sizeof(*gctx->tree) * nodes_num);
+
+    struct tree_node_s *level = gctx->tree;
+    uint32_t children = gctx->threads_num;
+    do {
+        width = (children + TREE_FANIN - 1) / TREE_FANIN;
+        for (uint32_t j = 0; j < width; j++) {
+            struct tree_node_s *node = &level[j];
+            node->children = j + 1 < width ? TREE_FANIN
+                                           : children - j * TREE_FANIN;
+            if (width > 1) {
+                node->parent = &level[width + j / TREE_FANIN];
+                node->parent_slot = j % TREE_FANIN;
+            }
+        }
+        level += width;
+        children = width;
+    } while (width > 1);
+
+    return 0;
+}
+
 void *worker(struct tctx_s *tctx) {
     struct global_ctx_s *gctx = tctx->gctx;
-    int *b = gctx->b;
-    int **A = gctx->A;
-    _Atomic double *X = gctx->X;
+    coef_t *b = gctx->b;
+    coef_t **A = gctx->A;
+    _Atomic real_t *X = gctx->X;
+    _Atomic real_t *X_prev = gctx->X_prev;
+    real_t w = gctx->w;
 
     int own_rows_num = gctx->n / gctx->threads_num +
                        (tctx->idx + 1 <= gctx->n % gctx->threads_num ? 1 : 0);
 
     printf("Workder %d start, own_rows_num: %d\n", tctx->idx, own_rows_num);
-    bool run = atomic_load(&gctx->run);
-    int gi = atomic_load(&gctx->i);
+    bool run = true;
+    int gi = gctx->i;
     while (run) {
+        double local_e = 0;
         for (int row_i = 0; row_i < own_rows_num; row_i++) {
             int row = tctx->idx + gctx->threads_num * row_i;
 
-            double old_X = X[row];
-            double old_part = (1 - gctx->w) * old_X;
+            if (gctx->A_map != NULL && row % gctx->stream_rows == 0)
+                stream_advance(gctx, row / gctx->stream_rows);
+
+            real_t old_X = X[row];
+            real_t old_part = (1 - w) * old_X;
 
-            double new_part = b[row];
+            real_t new_part = b[row];
             for (int i = gctx->n - 1; i > row; i--) {
                 new_part -= A[row][i] * X[i];
             }
 
+            // The lower part is taken against both the new and the previous
+            // values, the latter gives the exact residual of the iterate
+            // this sweep started from
+            real_t res_part = new_part;
             for (int i = row - 1; i >= 0; i--) {
                 while (atomic_load(&gctx->Xi[i]) != gi) {
                     continue;
                 }
                 new_part -= A[row][i] * X[i];
+                res_part -= A[row][i] * X_prev[i];
             }
 
-            new_part = gctx->w * (new_part / (double)A[row][row]);
-            atomic_store(&X[row], old_part + new_part);
-            atomic_store(&gctx->e[row], fabs(old_X - X[row]));
+            real_t res = res_part - A[row][row] * old_X;
 
+            new_part = w * (new_part / (real_t)A[row][row]);
+            atomic_store(&X_prev[row], old_X);
+            atomic_store(&X[row], old_part + new_part);
             atomic_fetch_add(&gctx->Xi[row], 1);
+
+            double e = gctx->criterion == CRIT_UPDATE ? fabs(old_X - X[row])
+                                                      : fabs(res);
+            if (gctx->criterion == CRIT_L2)
+                local_e += e * e;
+            else if (local_e < e)
+                local_e = e;
         }
 
-        while (atomic_load(&gctx->i) == gi) {
-            continue;
+        tctx->sense = !tctx->sense;
+        run = tree_arrive(gctx, &gctx->tree[tctx->idx / TREE_FANIN],
+                          tctx->idx % TREE_FANIN, local_e, tctx->sense, gi);
+        gi++;
+    }
+
+    if (gctx->residual) {
+        for (int row_i = 0; row_i < own_rows_num; row_i++) {
+            int row = tctx->idx + gctx->threads_num * row_i;
+
+            double r = b[row];
+            for (int i = 0; i < gctx->n; i++) {
+                r -= A[row][i] * X[i];
+            }
+
+            tctx->r_sum += r * r;
+            if (tctx->r_max < fabs(r)) tctx->r_max = fabs(r);
         }
-        gi = atomic_load(&gctx->i);
-        run = atomic_load(&gctx->run);
     }
 
     printf("Worker %d is finished\n", tctx->idx);
+    return NULL;
 }
 
 int count_digits(int n) {
@@ -100,87 +333,279 @@ int populate_ab_from_file(struct global_ctx_s *gctx, char *path) {
 
     for (int i = 0; i < gctx->n; i++) {
         for (int j = 0; j < gctx->n; j++) {
-            fscanf(f, "%d", &gctx->A[i][j]);
+            if (fscanf(f, COEF_SCN, &gctx->A[i][j]) != 1) {
+                fprintf(stderr, "Bad coefficient at row %d, column %d\n", i, j);
+                fclose(f);
+                return -1;
+            }
+        }
+        if (fscanf(f, COEF_SCN, &gctx->b[i]) != 1) {
+            fprintf(stderr, "Bad right-hand side at row %d\n", i);
+            fclose(f);
+            return -1;
         }
-        fscanf(f, "%d", &gctx->b[i]);
     }
     fclose(f);
 
     return 0;
 }
 
-int populate_ab(struct global_ctx_s *gctx) {
-    uint32_t new_max;
+int populate_ab_from_binary_file(struct global_ctx_s *gctx, char *path) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Filed to open file");
+        return -1;
+    }
 
-    // srand(time(NULL));
-    srand(1234567890);
-    for (int i = 0; i < gctx->n; i++) {
-        gctx->b[i] = rand() % (2 * PARAM_ABS_MAX + 1) - PARAM_ABS_MAX;
-        while (gctx->A[i][i] == 0)
-            gctx->A[i][i] = rand() % (2 * PARAM_ABS_MAX + 1) - PARAM_ABS_MAX;
+    gctx->A_map_len = sizeof(*gctx->A_map) * (gctx->n * gctx->n + gctx->n);
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size != gctx->A_map_len) {
+        fprintf(stderr, "Binary system must hold %lu values of %lu bytes\n",
+                gctx->n * gctx->n + gctx->n, sizeof(coef_t));
+        close(fd);
+        return -1;
+    }
 
-        new_max = (uint32_t) (abs(gctx->A[i][i]) / (double) (gctx->n - 1) - 1);
+    gctx->A_map = mmap(NULL, gctx->A_map_len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (gctx->A_map == MAP_FAILED) {
+        gctx->A_map = NULL;
+        perror("Filed to map file");
+        return -1;
+    }
 
-        for (int j = 0; j < gctx->n; j++) {
-            if (i != j) {
-                gctx->A[i][j] = rand() % (2 * new_max + 1) - new_max;
+    for (int i = 0; i < gctx->n; i++) gctx->A[i] = gctx->A_map + i * gctx->n;
+
+    memcpy(gctx->b, gctx->A_map + gctx->n * gctx->n,
+           sizeof(*gctx->b) * gctx->n);
+    madvise(gctx->A_map, gctx->A_map_len, MADV_DONTNEED);
+
+    if (gctx->stream_rows == 0)
+        gctx->stream_rows =
+            STREAM_BLOCK_BYTES / (gctx->n * sizeof(*gctx->A_map));
+    if (gctx->stream_rows == 0) gctx->stream_rows = 1;
+    stream_madvise(gctx, 0, MADV_WILLNEED);
+
+    return 0;
+}
+
+// Philox4x32-10 counter-based generator: the output depends only on the
+// counter, so every row is generated independently of the others
+void gen_rand4(uint32_t row, uint32_t col, uint32_t stream, uint32_t r[4]) {
+    uint32_t key[2] = {(uint32_t)GEN_SEED, (uint32_t)(GEN_SEED >> 32)};
+
+    r[0] = row;
+    r[1] = col;
+    r[2] = stream;
+    r[3] = 0;
+    for (int round = 0; round < 10; round++) {
+        uint64_t p0 = (uint64_t)0xD2511F53u * r[0];
+        uint64_t p1 = (uint64_t)0xCD9E8D57u * r[2];
+
+        r[0] = (uint32_t)(p1 >> 32) ^ r[1] ^ key[0];
+        r[1] = (uint32_t)p1;
+        r[2] = (uint32_t)(p0 >> 32) ^ r[3] ^ key[1];
+        r[3] = (uint32_t)p0;
+
+        key[0] += 0x9E3779B9u;
+        key[1] += 0xBB67AE85u;
+    }
+}
+
+int gen_uniform(uint32_t r, int max) {
+    return (int)(r % (2u * max + 1)) - max;
+}
+
+int parse_gen_family(const char *name) {
+    if (strcmp(name, "random") == 0) return GEN_RANDOM;
+    if (strcmp(name, "tridiag") == 0) return GEN_TRIDIAG;
+    if (strcmp(name, "laplace") == 0) return GEN_LAPLACE;
+
+    return -1;
+}
+
+int parse_criterion(const char *name) {
+    if (strcmp(name, "update") == 0) return CRIT_UPDATE;
+    if (strcmp(name, "l2") == 0) return CRIT_L2;
+    if (strcmp(name, "linf") == 0) return CRIT_LINF;
+
+    return -1;
+}
+
+void init_criterion(struct global_ctx_s *gctx) {
+    double norm = 0;
+
+    for (uint64_t i = 0; i < gctx->n; i++) {
+        if (gctx->criterion == CRIT_L2)
+            norm += (double)gctx->b[i] * gctx->b[i];
+        else if (norm < fabs((double) gctx->b[i]))
+            norm = fabs((double) gctx->b[i]);
+    }
+
+    if (gctx->criterion == CRIT_L2) norm = sqrt(norm);
+
+    gctx->b_norm = gctx->criterion == CRIT_UPDATE || norm == 0 ? 1 : norm;
+}
+
+void populate_row(struct global_ctx_s *gctx, uint64_t row) {
+    coef_t *A_row = gctx->A[row];
+    uint64_t grid = gctx->gen_grid;
+    uint32_t r[4];
+
+    switch (gctx->gen_family) {
+        case GEN_RANDOM:
+            gen_rand4(row, 0, GEN_STREAM_B, r);
+            gctx->b[row] = gen_uniform(r[0], PARAM_ABS_MAX);
+
+            // Off-diagonal entries stay within PARAM_ABS_MAX and the diagonal grows
+            // with n, so the row is strictly diagonally dominant at any size
+            gen_rand4(row, 0, GEN_STREAM_DIAG, r);
+            int64_t diag = (int64_t)(gctx->n - 1) * PARAM_ABS_MAX + 1 +
+                           r[0] % PARAM_ABS_MAX;
+            A_row[row] = (coef_t)(r[1] & 1 ? diag : -diag);
+
+            for (uint64_t j = 0; j < gctx->n; j++) {
+                if (j % 4 == 0) gen_rand4(row, j / 4, GEN_STREAM_A, r);
+                if (j != row) A_row[j] = gen_uniform(r[j % 4], PARAM_ABS_MAX);
             }
-        }
+            break;
+
+        case GEN_TRIDIAG:
+            gen_rand4(row, 0, GEN_STREAM_B, r);
+            gctx->b[row] = gen_uniform(r[0], GEN_TRIDIAG_DIAG);
+
+            A_row[row] = GEN_TRIDIAG_DIAG;
+            coef_t nd = (coef_t)(gctx->gen_coupling * GEN_TRIDIAG_DIAG / 2);
+            if (row > 0) A_row[row - 1] = -nd;
+            if (row + 1 < gctx->n) A_row[row + 1] = -nd;
+            break;
+
+        case GEN_LAPLACE:
+            // 5-point stencil on a grid x grid mesh, rows numbered row by row
+            gen_rand4(row, 0, GEN_STREAM_B, r);
+            gctx->b[row] = gen_uniform(r[0], PARAM_ABS_MAX);
+
+            A_row[row] = 4;
+            if (row % grid != 0) A_row[row - 1] = -1;
+            if ((row + 1) % grid != 0) A_row[row + 1] = -1;
+            if (row >= grid) A_row[row - grid] = -1;
+            if (row + grid < gctx->n) A_row[row + grid] = -1;
+            break;
+    }
+}
+
+void *populate_worker(struct tctx_s *tctx) {
+    struct global_ctx_s *gctx = tctx->gctx;
+
+    for (uint64_t row = tctx->idx; row < gctx->n; row += gctx->threads_num) {
+        populate_row(gctx, row);
+    }
+
+    return NULL;
+}
+
+int populate_ab(struct global_ctx_s *gctx) {
+    gctx->gen_grid = (uint64_t)sqrt((double)gctx->n);
+
+    if (gctx->gen_family == GEN_LAPLACE &&
+        gctx->gen_grid * gctx->gen_grid != gctx->n) {
+        fprintf(stderr, "Laplace system size must be a square, got %lu\n",
+                gctx->n);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < gctx->threads_num; i++) {
+        gctx->tctxs[i].gctx = gctx;
+        gctx->tctxs[i].idx = i;
+
+        pthread_create(&gctx->threads[i], NULL, (void *(*)(void *))populate_worker,
+                       &gctx->tctxs[i]);
+    }
+
+    for (uint32_t i = 0; i < gctx->threads_num; i++) {
+        pthread_join(gctx->threads[i], NULL);
     }
 
     return 0;
 }
 
-void init_gctx(struct global_ctx_s *gctx) {
+void init_gctx(struct global_ctx_s *gctx, bool stream) {
     gctx->threads = calloc(sizeof(*gctx->threads), gctx->threads_num);
-    memset(gctx->threads, 0, sizeof(*gctx->threads) * gctx->threads_num);
 
     gctx->tctxs = calloc(sizeof(*gctx->tctxs), gctx->threads_num);
-    memset(gctx->tctxs, 0, sizeof(*gctx->tctxs) * gctx->threads_num);
 
+    // Rows come from calloc untouched, the generator threads fault them in
     gctx->A = calloc(sizeof(*gctx->A), gctx->n);
-    for (int i = 0; i < gctx->n; i++) {
+    for (int i = 0; i < gctx->n && !stream; i++) {
         gctx->A[i] = calloc(sizeof(*gctx->A[i]), gctx->n);
-        memset(gctx->A[i], 0, sizeof(*gctx->A[i]) * gctx->n);
     }
 
     gctx->X = calloc(sizeof(*gctx->X), gctx->n);
-    memset(gctx->X, 0, sizeof(*gctx->X) * gctx->n);
 
-    gctx->b = calloc(sizeof(*gctx->b), gctx->n);
-    memset(gctx->b, 0, sizeof(*gctx->b) * gctx->n);
+    gctx->X_prev = calloc(sizeof(*gctx->X_prev), gctx->n);
 
-    gctx->e = calloc(sizeof(*gctx->e), gctx->n);
-    memset(gctx->e, DBL_MAX, sizeof(*gctx->e) * gctx->n);
+    gctx->b = calloc(sizeof(*gctx->b), gctx->n);
 
     gctx->Xi = calloc(sizeof(*gctx->Xi), gctx->n);
-    memset(gctx->Xi, 0, sizeof(*gctx->Xi) * gctx->n);
 }
 
 int main(int argc, char *argv[]) {
     int ret, opt;
     char *linear_system_path = NULL;
     char *linear_system_solve_path = NULL;
+    char *linear_system_map_path = NULL;
+    char *linear_system_solve_bin_path = NULL;
     struct global_ctx_s gctx = {.threads_num = 4,
                                 .n = 8,
                                 .max_e = 0.0000001,
                                 .i = 1,
                                 .w = 1.5,
-                                .run = true};
+                                .success = true,
+                                .gen_family = GEN_RANDOM,
+                                .gen_coupling = 0.5,
+                                .criterion = CRIT_UPDATE};
 
-    while ((opt = getopt(argc, argv, "hc:o:t:n:w:e:")) != -1) {
+    while ((opt = getopt(argc, argv, "hc:m:s:g:k:o:O:rt:n:w:e:C:")) != -1) {
         switch (opt) {
             case 'h':
                 printf(
-                    "-c - file with linear system, -t - threads, -n - matrix "
-                    "size, -w - relax, -e - toler\n");
+                    "-c - file with linear system, -m - binary linear system "
+                    "file to stream from, -s - stream block rows, -g - "
+                    "generated system (random, tridiag, laplace), -k - "
+                    "tridiag coupling, -o - text "
+                    "solution file, -O - binary solution file, -r - report "
+                    "residual, -t - threads, -n - matrix size, -w - relax, "
+                    "-e - toler, -C - stop criterion (update, l2, linf)\n");
                 return 0;
             case 'c':
                 linear_system_path = optarg;
                 break;
+            case 'm':
+                linear_system_map_path = optarg;
+                break;
+            case 's':
+                gctx.stream_rows = atoi(optarg);
+                break;
+            case 'g':
+                ret = parse_gen_family(optarg);
+                if (ret < 0) {
+                    fprintf(stderr, "Unknown generated system %s\n", optarg);
+                    return 1;
+                }
+                gctx.gen_family = ret;
+                break;
+            case 'k':
+                gctx.gen_coupling = atof(optarg);
+                break;
             case 'o':
                 linear_system_solve_path = optarg;
                 break;
+            case 'O':
+                linear_system_solve_bin_path = optarg;
+                break;
+            case 'r':
+                gctx.residual = true;
+                break;
             case 't':
                 gctx.threads_num = atoi(optarg);
                 break;
@@ -193,15 +618,25 @@ int main(int argc, char *argv[]) {
             case 'e':
                 gctx.max_e = atof(optarg);
                 break;
+            case 'C':
+                ret = parse_criterion(optarg);
+                if (ret < 0) {
+                    fprintf(stderr, "Unknown stop criterion %s\n", optarg);
+                    return 1;
+                }
+                gctx.criterion = ret;
+                break;
 
             default:
                 return 1;
         }
     }
 
-    init_gctx(&gctx);
+    init_gctx(&gctx, linear_system_map_path != NULL);
 
-    if (linear_system_path != NULL)
+    if (linear_system_map_path != NULL)
+        ret = populate_ab_from_binary_file(&gctx, linear_system_map_path);
+    else if (linear_system_path != NULL)
         ret = populate_ab_from_file(&gctx, linear_system_path);
     else
         ret = populate_ab(&gctx);
@@ -211,6 +646,13 @@ int main(int argc, char *argv[]) {
         return ret;
     }
 
+    init_criterion(&gctx);
+
+    if (init_tree(&gctx) != 0) {
+        perror("Failed to allocate sweep barrier\n");
+        return -1;
+    }
+
     // printf("Linear system n = %d: \n", gctx.n);
     // for (int i = 0; i < gctx.n; i++) {
     //     for (int j = 0; j < gctx.n; j++) {
@@ -220,6 +662,10 @@ int main(int argc, char *argv[]) {
     // }
     // printf("max e = %g, w = %g\n", gctx.max_e, gctx.w);
 
+    // Sweeps only, without setup and generation, for the benchmark suite
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
     for (int i = 0; i < gctx.threads_num; i++) {
         gctx.tctxs[i].gctx = &gctx;
         gctx.tctxs[i].idx = i;
@@ -227,37 +673,29 @@ int main(int argc, char *argv[]) {
         pthread_create(&gctx.threads[i], NULL, worker, &gctx.tctxs[i]);
     }
 
-    double cur_max_e = 0;
-    bool success = true;
-    while (gctx.run) {
-        cur_max_e = 0;
-        for (int i = 0; i < gctx.n; i++) {
-            while (atomic_load(&gctx.Xi[i]) != gctx.i) {
-                continue;
-            }
+    for (int i = 0; i < gctx.threads_num; i++) {
+        pthread_join(gctx.threads[i], NULL);
+    }
 
-            if (cur_max_e < atomic_load(&gctx.e[i]))
-                cur_max_e = atomic_load(&gctx.e[i]);
-        }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
 
-        if (gctx.i + 1 >= ITERATIONS_MAX) {
-            atomic_store(&gctx.run, false);
-            success = false;
-        } else if (cur_max_e < gctx.max_e) {
-            atomic_store(&gctx.run, false);
+    if (gctx.success) {
+        if (gctx.residual) {
+            double r_sum = 0, r_max = 0;
+            for (int i = 0; i < gctx.threads_num; i++) {
+                r_sum += gctx.tctxs[i].r_sum;
+                if (r_max < gctx.tctxs[i].r_max) r_max = gctx.tctxs[i].r_max;
+            }
+            printf(
+                "Get result for %d iterations, max e %g, residual l2 %g, "
+                "linf %g\n",
+                gctx.i, gctx.result_e, sqrt(r_sum), r_max);
         } else {
-            // printf("X: \n");
-            // for (int i = 0; i < gctx.n; i++) {
-            //     printf("%.2f ", gctx.X[i]);
-            // }
-            // printf("\n"); 
-            // printf("%g\n", cur_max_e); 
+            printf("Get result for %d iterations, max e %g\n", gctx.i,
+                   gctx.result_e);
         }
-        atomic_fetch_add(&gctx.i, 1);
-    }
-
-    if (success) {
-        printf("Get result for %d iterations, max e %g\n", gctx.i - 1, cur_max_e);
+        printf("Sweep time %g ms\n", elapsed * 1000 / gctx.i);
         // printf("X: \n");
         // for (int i = 0; i < gctx.n; i++) {
         //     printf("%.2f ", gctx.X[i]);
@@ -276,14 +714,25 @@ int main(int argc, char *argv[]) {
             }
             fclose(f);
         }
+
+        if (linear_system_solve_bin_path != NULL) {
+            FILE *f = fopen(linear_system_solve_bin_path, "wb");
+            if (f == NULL) {
+                perror("Filed to open linear_system_solve_bin_path");
+                return -1;
+            }
+
+            // Always float64, whatever real_t is in this build
+            for (int i = 0; i < gctx.n; i++) {
+                double x = gctx.X[i];
+                fwrite(&x, sizeof(x), 1, f);
+            }
+            fclose(f);
+        }
     } else {
         printf("Failed to solve, reached iterations limit %d\n",
                ITERATIONS_MAX);
     }
 
-    for (int i = 0; i < gctx.threads_num; i++) {
-        pthread_join(gctx.threads[i], NULL);
-    }
-
     return 0;
 }
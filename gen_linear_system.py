@@ -48,6 +48,16 @@ def write_linear_system_to_file(A, b, linsys_path, prefix=""):
             f.write(prefix + (" ".join(map(str, Ab[j].tolist()))) + "\n")
 
 
+def write_linear_system_to_binary_file(A, b, linsys_path, dtype=np.int32):
+    # Layout read by the solvers' -m (streaming) mode: A row-major, then b,
+    # all as native dtype. It must match the solvers' COEF build type:
+    # np.int32 (default), np.float32 (COEF=float) or np.float64 (COEF=double).
+    # Needs A in memory, systems larger than that come from `sor -g ... -D`
+    with open(linsys_path, "wb") as f:
+        A.astype(dtype).tofile(f)
+        b.astype(dtype).tofile(f)
+
+
 def main():
     n = 2000
     A, b = gen_linear_three_diagonal_system(n, 0.00001)
@@ -0,0 +1,19 @@
+import os
+from setuptools import setup, Extension
+
+# Coefficient type of A and b, same as the solvers: COEF=int|float|double
+coef = os.environ.get("COEF", "int")
+
+setup(
+    name="sor_ext",
+    ext_modules=[
+        Extension(
+            "sor_ext",
+            sources=["sor_ext.c"],
+            extra_compile_args=["-O3", "-fopenmp"],
+            extra_link_args=["-fopenmp"],
+            libraries=["m"],
+            define_macros=[] if coef == "int" else [(f"COEF_{coef.upper()}", None)],
+        )
+    ],
+)
@@ -0,0 +1,151 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#define SOR_NO_MAIN
+#include "../c_omp/c_omp.c"
+
+
+static int get_buffer(PyObject *obj, Py_buffer *view, const char *format,
+                      int ndim, bool writable, const char *name) {
+    int flags = PyBUF_C_CONTIGUOUS | PyBUF_FORMAT;
+
+    if (writable)
+        flags |= PyBUF_WRITABLE;
+
+    if (PyObject_GetBuffer(obj, view, flags) < 0)
+        return -1;
+
+    const char *f = view->format;
+    if (*f == '@' || *f == '=' || *f == '<')
+        f++;
+
+    if (view->ndim != ndim || strcmp(f, format) != 0) {
+        PyErr_Format(PyExc_TypeError,
+                     "%s must be a %d-d C-contiguous buffer of '%s'", name,
+                     ndim, format);
+        PyBuffer_Release(view);
+        return -1;
+    }
+
+    return 0;
+}
+
+// sor(A, b, X, w=1.5, e=1e-7, threads=4, chunk=1, criterion="update")
+//
+// A is n x n and b is n of the build coefficient type, sor_ext.coef_format:
+// int32 by default, float32 or float64 with COEF=float or COEF=double. X is
+// n of sor_ext.x_format: float32 with COEF=float, float64 otherwise. All are
+// used in place without copies. X holds the initial guess and receives the
+// solution.
+// Returns (X, iterations, e).
+static PyObject *sor_ext_sor(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"A", "b", "X", "w", "e", "threads", "chunk",
+                             "criterion", NULL};
+    PyObject *A_obj, *b_obj, *X_obj;
+    Py_buffer A_view, b_view, X_view;
+    const char *criterion = "update";
+    struct global_ctx_s gctx = {
+        .threads_num = 4,
+        .max_e = 0.0000001,
+        .i = 1,
+        .w = 1.5,
+        .chunk = 1,
+        .iterations_max = ITERATIONS_MAX,
+        .quiet = true
+    };
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOO|ddIIs", kwlist,
+                                     &A_obj, &b_obj, &X_obj, &gctx.w,
+                                     &gctx.max_e, &gctx.threads_num,
+                                     &gctx.chunk, &criterion))
+        return NULL;
+
+    int ret = parse_criterion(criterion);
+    if (ret < 0)
+        return PyErr_Format(PyExc_ValueError, "Unknown stop criterion %s",
+                            criterion);
+    gctx.criterion = ret;
+
+    if (gctx.threads_num == 0 || gctx.chunk == 0)
+        return PyErr_Format(PyExc_ValueError,
+                            "threads and chunk must be positive");
+
+    if (get_buffer(A_obj, &A_view, COEF_FMT, 2, false, "A") < 0)
+        return NULL;
+    if (get_buffer(b_obj, &b_view, COEF_FMT, 1, false, "b") < 0) {
+        PyBuffer_Release(&A_view);
+        return NULL;
+    }
+    if (get_buffer(X_obj, &X_view, REAL_FMT, 1, true, "X") < 0) {
+        PyBuffer_Release(&A_view);
+        PyBuffer_Release(&b_view);
+        return NULL;
+    }
+
+    gctx.n = b_view.shape[0];
+    if (A_view.shape[0] != gctx.n || A_view.shape[1] != gctx.n ||
+        X_view.shape[0] != gctx.n) {
+        PyErr_SetString(PyExc_ValueError,
+                        "A must be n x n, b and X must have n elements");
+        goto out;
+    }
+
+    // Row pointers into the caller's A, the matrix itself is not copied
+    gctx.A = calloc(sizeof(*gctx.A), gctx.n);
+    gctx.Xi = calloc(sizeof(*gctx.Xi), gctx.n);
+    gctx.X_prev = calloc(sizeof(*gctx.X_prev), gctx.n);
+    if (gctx.A == NULL || gctx.Xi == NULL || gctx.X_prev == NULL) {
+        PyErr_NoMemory();
+        goto out;
+    }
+
+    for (uint64_t i = 0; i < gctx.n; i++)
+        gctx.A[i] = (coef_t *) A_view.buf + i * gctx.n;
+    gctx.b = b_view.buf;
+    gctx.X = X_view.buf;
+
+    Py_BEGIN_ALLOW_THREADS
+    init_criterion(&gctx);
+    sor(&gctx);
+    Py_END_ALLOW_THREADS
+
+out:
+    free(gctx.A);
+    free(gctx.Xi);
+    free(gctx.X_prev);
+    PyBuffer_Release(&A_view);
+    PyBuffer_Release(&b_view);
+    PyBuffer_Release(&X_view);
+
+    if (PyErr_Occurred())
+        return NULL;
+
+    return Py_BuildValue("(Oid)", X_obj, gctx.result_i, gctx.result_e);
+}
+
+static PyMethodDef sor_ext_methods[] = {
+    {"sor", (PyCFunction) sor_ext_sor, METH_VARARGS | METH_KEYWORDS,
+     "sor(A, b, X, w=1.5, e=1e-7, threads=4, chunk=1, criterion='update')\n"
+     "Solve AX = b in place with the OpenMP SOR kernel, X is the initial\n"
+     "guess. Returns (X, iterations, e)."},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef sor_ext_module = {
+    PyModuleDef_HEAD_INIT, "sor_ext", NULL, -1, sor_ext_methods
+};
+
+PyMODINIT_FUNC PyInit_sor_ext(void) {
+    PyObject *m = PyModule_Create(&sor_ext_module);
+    if (m == NULL)
+        return NULL;
+
+    // Buffer formats of A and b, and of X, in this build, usable as numpy dtypes
+    if (PyModule_AddStringConstant(m, "coef_format", COEF_FMT) < 0 ||
+        PyModule_AddStringConstant(m, "x_format", REAL_FMT) < 0) {
+        Py_DECREF(m);
+        return NULL;
+    }
+
+    return m;
+}
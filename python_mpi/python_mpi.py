@@ -130,9 +130,11 @@ def main():
     parser = argparse.ArgumentParser(description="Process linear system parameters.")
     parser.add_argument("-c", type=str, help="File with linear system", required=False)
     parser.add_argument("-o", type=str, help="Output file for solution", required=False)
+    parser.add_argument("-O", type=str, help="Binary output file for solution", required=False)
     parser.add_argument("-n", type=int, help="Matrix size", required=False)
     parser.add_argument("-w", type=float, help="Relaxation factor", required=False)
     parser.add_argument("-e", type=float, help="Tolerance", required=False)
+    parser.add_argument("-r", action="store_true", help="Report residual")
     
     args = parser.parse_args()
     
@@ -150,6 +152,7 @@ def main():
 
     linear_system_path = args.c
     linear_system_solve_path = args.o
+    linear_system_solve_bin_path = args.O
 
     if rank == 0:
         if linear_system_path is not None:
@@ -168,7 +171,11 @@ def main():
 
     if rank == 0:
         # print(task.X)
-        
+
+        if args.r:
+            r = task.b - task.A @ task.X
+            print(f"Residual l2 {np.linalg.norm(r, ord=2)}, linf {np.linalg.norm(r, ord=np.inf)}")
+
         if linear_system_solve_path is not None: 
             try:
                 with open(linear_system_solve_path, "w") as f:
@@ -177,5 +184,12 @@ def main():
             except FileNotFoundError:
                 print("Failed to open linear_system_solve_path")
 
+        if linear_system_solve_bin_path is not None:
+            try:
+                with open(linear_system_solve_bin_path, "wb") as f:
+                    task.X.astype(np.float64).tofile(f)
+            except FileNotFoundError:
+                print("Failed to open linear_system_solve_bin_path")
+
 if __name__ == "__main__":
     main()
\ No newline at end of file
@@ -1,19 +1,30 @@
 import os
+import sys
 import subprocess
 import random
 import numpy as np
 from string import Template
 from typing import Dict, Union, List
+import re
 import math
 import csv
 import time
 
-from gen_linear_system import gen_linear_three_diagonal_system
+from gen_linear_system import (
+    gen_linear_three_diagonal_system,
+    write_linear_system_to_binary_file,
+)
+
+try:
+    import sor_ext
+except ImportError:
+    sor_ext = None
 
 
 w = 1.5
 e = 0.000000000001
 ns = [(2000, 0.00001)]  # A sizes
+direct_solve_max_n = 2000  # dense reference solve is O(n^3), skip it above
 instance_nums = [1, 2, 3, 4, 6, 8]  # threads / procs num
 
 
@@ -32,38 +43,87 @@ algs: List[Dict[str, Union[str, Template]]] = [
     {
         "name": "c_pthreads",
         "cmd": Template(
-            f"{algs_paths['c_pthread']} -c $linsys_path -o $out_path -n $n -t $t -e $e -w $w"
+            f"{algs_paths['c_pthread']} -c $linsys_path -O $out_path -r -n $n -t $t -e $e -w $w"
         ),
     },
     {
         "name": "c_omp",
         "cmd": Template(
-            f"{algs_paths['c_omp']} -c $linsys_path -o $out_path -n $n -t $t -e $e -w $w"
+            f"{algs_paths['c_omp']} -c $linsys_path -O $out_path -r -n $n -t $t -e $e -w $w"
+        ),
+    },
+    {
+        "name": "c_omp_tasks",
+        "cmd": Template(
+            f"{algs_paths['c_omp']} -c $linsys_path -O $out_path -r -n $n -t $t -e $e -w $w -T 64"
+        ),
+    },
+    {
+        # Streamed from the binary layout in small blocks, so that the
+        # prefetch and release of blocks is exercised
+        "name": "c_omp_stream",
+        "cmd": Template(
+            f"{algs_paths['c_omp']} -m $linsys_bin_path -s 64 -O $out_path -r -n $n -t $t -e $e -w $w"
+        ),
+    },
+    {
+        "name": "c_omp_l2",
+        "cmd": Template(
+            f"{algs_paths['c_omp']} -c $linsys_path -O $out_path -r -n $n -t $t -e $e -w $w -C l2"
         ),
     },
     {
         "name": "c_mpi",
         "cmd": Template(
-            f"mpirun --use-hwthread-cpus -np $t {algs_paths['c_mpi']} -c $linsys_path -o $out_path -n $n -e $e -w $w"
+            f"mpirun --use-hwthread-cpus -np $t {algs_paths['c_mpi']} -c $linsys_path -O $out_path -r -n $n -e $e -w $w"
         ),
     },
     {
         "name": "python_mpi",
         "cmd": Template(
-            f"mpirun --use-hwthread-cpus -np $t /usr/bin/python3 {algs_paths['python_mpi']} -c $linsys_path -o $out_path -n $n -e $e -w $w"
+            f"mpirun --use-hwthread-cpus -np $t /usr/bin/python3 {algs_paths['python_mpi']} -c $linsys_path -O $out_path -r -n $n -e $e -w $w"
         ),
     },
 ]
 
+if sor_ext is not None:
+    # In-process OpenMP kernel, no text I/O and no process launch
+    algs.append(
+        {
+            "name": "c_omp_ext",
+            "fn": lambda A, b, t: sor_ext.sor(
+                A,
+                b,
+                np.zeros(b.size, dtype=np.dtype(sor_ext.x_format)),
+                w=w,
+                e=e,
+                threads=t,
+            )[0],
+        }
+    )
+
+
+residual_re = re.compile(r"residual l2 ([^,\s]+), linf (\S+)", re.IGNORECASE)
+
 
 def main():
     result = list()
+    failed = list()
     linsys_dir = os.path.join(module_path(), "linsys")
     outs_dir = os.path.join(module_path(), "outs")
     test_out = os.path.join(module_path(), "test_out.csv")
     csv_writer = csv.DictWriter(
         open(test_out, "w"),
-        fieldnames=["alg", "instances", "n", "elapsed_ms", "l2_norm", "relative_error"],
+        fieldnames=[
+            "alg",
+            "instances",
+            "n",
+            "elapsed_ms",
+            "residual_l2",
+            "residual_linf",
+            "relative_residual",
+            "relative_error",
+        ],
     )
     csv_writer.writeheader()
 
@@ -74,8 +134,10 @@ def main():
     for i in range(0, len(ns)):
         n, rel = ns[i]
         A, b = gen_linear_three_diagonal_system(n, rel)
-        sol = np.linalg.solve(A, b)
-        linsys.append((A, b, np.round(sol, decimals=int(abs(math.log10(e))))))
+        sol = None
+        if n <= direct_solve_max_n:
+            sol = np.round(np.linalg.solve(A, b), decimals=int(abs(math.log10(e))))
+        linsys.append((A, b, sol))
 
         b = b.reshape(-1, 1)
         Ab = np.hstack((A, b))
@@ -84,56 +146,101 @@ def main():
             for j in range(0, n):
                 f.write(" ".join(map(str, Ab[j].tolist())) + "\n")
 
+        # Default int build of the solvers, see write_linear_system_to_binary_file
+        linsys_bin_path = os.path.join(linsys_dir, f"{n}.bin")
+        write_linear_system_to_binary_file(linsys[i][0], linsys[i][1], linsys_bin_path)
+
         print(f"A|b = \n{Ab}")
         print(f"n = {n}\n")
+
+        # The extension takes A and b in the coefficient type it was built for
+        coef_dtype = np.dtype(sor_ext.coef_format) if sor_ext is not None else np.int32
+        A_ext = np.ascontiguousarray(linsys[i][0], dtype=coef_dtype)
+        b_ext = np.ascontiguousarray(linsys[i][1], dtype=coef_dtype)
         for instance_num in instance_nums:
             if instance_num > n:
                 continue
             print(f"instance num = {instance_num}\n")
 
             for alg in algs:
-                out_path = os.path.join(
-                    outs_dir, f"{alg['name']}_{n}_{instance_num}.txt"
-                )
-                cmd = alg["cmd"].substitute(
-                    linsys_path=linsys_path,
-                    out_path=out_path,
-                    n=n,
-                    t=instance_num,
-                    e=e,
-                    w=w,
+                if "fn" in alg:
+                    print(f"Alg: {alg['name']}")
+                    start_timestamp = time.time()
+                    solution = alg["fn"](A_ext, b_ext, instance_num)
+                    elapsed_ms = (time.time() - start_timestamp) * 1000
+
+                    # In-process, so the residual is one matrix-vector product
+                    r = b_ext - A_ext @ solution
+                    residual_l2 = np.linalg.norm(r, ord=2)
+                    residual_linf = np.linalg.norm(r, ord=np.inf)
+                else:
+                    out_path = os.path.join(
+                        outs_dir, f"{alg['name']}_{n}_{instance_num}.bin"
+                    )
+                    cmd = alg["cmd"].substitute(
+                        linsys_path=linsys_path,
+                        linsys_bin_path=linsys_bin_path,
+                        out_path=out_path,
+                        n=n,
+                        t=instance_num,
+                        e=e,
+                        w=w,
+                    )
+
+                    print(f"Alg: {alg['name']}\n{cmd}")
+                    start_timestamp = time.time()
+                    result = subprocess.run(
+                        map(str, cmd.split()), capture_output=True, text=True
+                    )
+                    elapsed_ms = (time.time() - start_timestamp) * 1000
+                    match = residual_re.search(result.stdout)
+                    if result.returncode != 0 or match is None:
+                        print("not converged")
+                        failed.append(f"{alg['name']} n {n} instances {instance_num}")
+                        continue
+
+                    # Computed by the solver itself (-r) after convergence
+                    residual_l2 = float(match.group(1))
+                    residual_linf = float(match.group(2))
+
+                    with open(out_path, "rb") as f:
+                        solution = np.fromfile(f, dtype=np.float64)
+
+                # print(f"{os.path.basename(out_path)}, solution \n{solution}")
+                # print(f"true solution \n{linsys[i][2].tolist()}")
+
+                relative_residual = residual_l2 / np.linalg.norm(linsys[i][1], ord=2)
+
+                # The reference solution is only there for small n
+                relative_error = None
+                if linsys[i][2] is not None:
+                    relative_error = np.linalg.norm(
+                        solution - linsys[i][2], ord=2
+                    ) / np.linalg.norm(linsys[i][2], ord=2)
+
+                print(
+                    f"residual l2 = {residual_l2}, linf = {residual_linf}, "
+                    f"relative_residual = {relative_residual}, "
+                    f"relative_error = {relative_error}\n"
                 )
 
-                print(f"Alg: {alg['name']}\n{cmd}")
-                start_timestamp = time.time()
-                result = subprocess.run(
-                    map(str, cmd.split()), stdout=subprocess.DEVNULL
+                csv_writer.writerow(
+                    {
+                        "alg": alg["name"],
+                        "instances": instance_num,
+                        "n": n,
+                        "elapsed_ms": elapsed_ms,
+                        "residual_l2": residual_l2,
+                        "residual_linf": residual_linf,
+                        "relative_residual": relative_residual,
+                        "relative_error": relative_error,
+                    }
                 )
-                elapsed_ms = (time.time() - start_timestamp) * 1000
-                if result.returncode == 0:
-                    with open(out_path, "r") as f:
-                        solution = [float(x) for x in f.readline().split()]
-                        # print(f"{os.path.basename(out_path)}, solution \n{solution}")
-                        # print(f"true solution \n{linsys[i][2].tolist()}")
-
-                        l2_norm = np.linalg.norm(solution - linsys[i][2], ord=2)
-                        relative_error = l2_norm / np.linalg.norm(linsys[i][2], ord=2)
-
-                        print(
-                            f"l2_norm = {l2_norm}, relative_error = {relative_error}\n"
-                        )
-
-                        csv_writer.writerow(
-                            {
-                                "alg": alg["name"],
-                                "instances": instance_num,
-                                "n": n,
-                                "elapsed_ms": elapsed_ms,
-                                "l2_norm": l2_norm,
-                                "relative_error": relative_error,
-                            }
-                        )
+
+    for run in failed:
+        print(f"FAIL {run}: not converged")
+    return 1 if failed else 0
 
 
 if __name__ == "__main__":
-    main()
+    sys.exit(main())